@@ -0,0 +1,68 @@
+#!/usr/bin/env python2
+# Copyright (c) 2019 The MktCoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the address index (-addressindex): the getaddress* calls follow
+# blocks that are connected and disconnected, and a node refuses to
+# start with a different -addressindex setting unless it reindexes.
+#
+
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import AuthServiceProxy, JSONRPCException
+from util import *
+import os
+import subprocess
+
+class AddressIndexTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        self.nodes = []
+        self.is_network_split = False
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-addressindex"]))
+
+    def check_address(self, address, txids, balance):
+        assert_equal(self.nodes[0].getaddresstxids([address]), txids)
+        assert_equal(self.nodes[0].getaddressbalance([address])["balance"], balance)
+        utxos = self.nodes[0].getaddressutxos([address])
+        assert_equal([utxo["txid"] for utxo in utxos], txids)
+        assert_equal(sum(utxo["amount"] for utxo in utxos), balance)
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.setgenerate(True, 101)
+        address = node.getnewaddress()
+        self.check_address(address, [], 0)
+
+        print "Connecting a payment adds it to the index"
+        txid = node.sendtoaddress(address, 10)
+        node.setgenerate(True, 1)
+        self.check_address(address, [txid], 10)
+        assert_equal(node.getaddressutxos([address])[0]["height"], 102)
+
+        print "Disconnecting the block removes it again"
+        tip = node.getbestblockhash()
+        node.invalidateblock(tip)
+        self.check_address(address, [], 0)
+        node.reconsiderblock(tip)
+        assert_equal(node.getbestblockhash(), tip)
+        self.check_address(address, [txid], 10)
+
+        print "Changing -addressindex without -reindex is refused"
+        stop_node(node, 0)
+        datadir = os.path.join(self.options.tmpdir, "node0")
+        ret = subprocess.call([os.getenv("BITCOIND", "mktcoind"), "-datadir="+datadir, "-addressindex=0"])
+        assert_equal(ret, 1)
+        with open(log_filename(self.options.tmpdir, 0, "debug.log")) as f:
+            assert("You need to rebuild the database using -reindex to change -addressindex" in f.read())
+
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-addressindex"])
+        self.check_address(address, [txid], 10)
+
+if __name__ == '__main__':
+    AddressIndexTest().main()
@@ -306,7 +306,7 @@ bool CActiveMasternode::Register(CTxIn vin, CService service, CKey keyCollateral
         CMasternode mn(mnb);
         mnodeman.Add(mn);
     } else {
-        pmn->UpdateFromNewBroadcast(mnb);
+        mnodeman.UpdateFromNewBroadcast(*pmn, mnb);
     }
 
     //send to all peers
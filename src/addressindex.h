@@ -0,0 +1,171 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "crypto/common.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+/** Address types in the address index (-addressindex) */
+enum AddressIndexType {
+    ADDRESS_INDEX_NONE = 0,
+    ADDRESS_INDEX_KEY = 1,    //! pay to pubkey hash or pay to pubkey, hashBytes is the key id
+    ADDRESS_INDEX_SCRIPT = 2, //! pay to script hash, hashBytes is the script id
+};
+
+/**
+ * Key of an address index entry: one credit (output) or debit (input) of an
+ * address by a transaction. The height is stored big endian, so the entries of
+ * an address are iterated in block order.
+ */
+class CAddressIndexKey
+{
+public:
+    unsigned char type;
+    uint160 hashBytes;
+    int nHeight;
+    uint256 txhash;
+    unsigned int index; //! output index, or input index when fSpending
+    bool fSpending;
+
+    CAddressIndexKey() : type(ADDRESS_INDEX_NONE), nHeight(0), index(0), fSpending(false) {}
+    CAddressIndexKey(int typeIn, const uint160& hashBytesIn, int nHeightIn, const uint256& txhashIn, unsigned int indexIn, bool fSpendingIn) : type(typeIn), hashBytes(hashBytesIn), nHeight(nHeightIn), txhash(txhashIn), index(indexIn), fSpending(fSpendingIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(type);
+        READWRITE(hashBytes);
+        unsigned char chHeight[4];
+        WriteBE32(chHeight, nHeight);
+        READWRITE(FLATDATA(chHeight));
+        nHeight = ReadBE32(chHeight);
+        READWRITE(txhash);
+        READWRITE(index);
+        READWRITE(fSpending);
+    }
+};
+
+/** Key of an unspent output of an address */
+class CAddressUnspentKey
+{
+public:
+    unsigned char type;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int index;
+
+    CAddressUnspentKey() : type(ADDRESS_INDEX_NONE), index(0) {}
+    CAddressUnspentKey(int typeIn, const uint160& hashBytesIn, const uint256& txhashIn, unsigned int indexIn) : type(typeIn), hashBytes(hashBytesIn), txhash(txhashIn), index(indexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(type);
+        READWRITE(hashBytes);
+        READWRITE(txhash);
+        READWRITE(index);
+    }
+};
+
+/** An unspent output of an address; a null value removes the entry */
+class CAddressUnspentValue
+{
+public:
+    CAmount nValue;
+    CScript script;
+    int nHeight;
+
+    CAddressUnspentValue() { SetNull(); }
+    CAddressUnspentValue(CAmount nValueIn, const CScript& scriptIn, int nHeightIn) : nValue(nValueIn), script(scriptIn), nHeight(nHeightIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nValue);
+        READWRITE(script);
+        READWRITE(nHeight);
+    }
+
+    void SetNull()
+    {
+        nValue = -1;
+        script.clear();
+        nHeight = 0;
+    }
+
+    bool IsNull() const { return nValue == -1; }
+};
+
+/** Key of the spent index: the output that was spent */
+class CSpentIndexKey
+{
+public:
+    uint256 txid;
+    unsigned int index;
+
+    CSpentIndexKey() : index(0) {}
+    CSpentIndexKey(const uint256& txidIn, unsigned int indexIn) : txid(txidIn), index(indexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(txid);
+        READWRITE(index);
+    }
+};
+
+/** The input that spent an output; a null value removes the entry */
+class CSpentIndexValue
+{
+public:
+    uint256 txid;
+    unsigned int index;
+    int nHeight;
+    CAmount nValue;
+    unsigned char type;
+    uint160 hashBytes;
+
+    CSpentIndexValue() { SetNull(); }
+    CSpentIndexValue(const uint256& txidIn, unsigned int indexIn, int nHeightIn, CAmount nValueIn, int typeIn, const uint160& hashBytesIn) : txid(txidIn), index(indexIn), nHeight(nHeightIn), nValue(nValueIn), type(typeIn), hashBytes(hashBytesIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(txid);
+        READWRITE(index);
+        READWRITE(nHeight);
+        READWRITE(nValue);
+        READWRITE(type);
+        READWRITE(hashBytes);
+    }
+
+    void SetNull()
+    {
+        txid = uint256();
+        index = 0;
+        nHeight = 0;
+        nValue = 0;
+        type = ADDRESS_INDEX_NONE;
+        hashBytes = uint160();
+    }
+
+    bool IsNull() const { return txid == uint256(); }
+};
+
+#endif // BITCOIN_ADDRESSINDEX_H
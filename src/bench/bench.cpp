@@ -0,0 +1,66 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "tinyformat.h"
+#include "utiltime.h"
+
+#include <iostream>
+
+std::map<std::string, benchmark::BenchFunction> benchmark::BenchRunner::benchmarks;
+
+static double gettimedouble(void)
+{
+    return GetTimeMicros() * 0.000001;
+}
+
+benchmark::BenchRunner::BenchRunner(std::string name, benchmark::BenchFunction func)
+{
+    benchmarks.insert(std::make_pair(name, func));
+}
+
+void benchmark::BenchRunner::RunAll(double elapsedTimeForOne)
+{
+    std::cout << "#Benchmark" << "," << "count" << "," << "min" << "," << "max" << "," << "average"
+              << "," << "items/s" << "," << "counters/iteration" << "\n";
+
+    for (std::map<std::string, benchmark::BenchFunction>::iterator it = benchmarks.begin();
+         it != benchmarks.end(); ++it) {
+        State state(it->first, elapsedTimeForOne);
+        benchmark::BenchFunction& func = it->second;
+        func(state);
+    }
+}
+
+bool benchmark::State::KeepRunning()
+{
+    double now;
+    if (count == 0) {
+        beginTime = now = gettimedouble();
+    } else {
+        now = gettimedouble();
+        double elapsed = now - lastTime;
+        if (elapsed < minTime) minTime = elapsed;
+        if (elapsed > maxTime) maxTime = elapsed;
+    }
+    lastTime = now;
+    ++count;
+
+    if (now - beginTime < maxElapsed) return true; // Keep going
+
+    --count;
+
+    // Output results
+    double total = now - beginTime;
+    double average = total / count;
+    std::string strCounters;
+    for (std::map<std::string, int64_t>::const_iterator it = mapCounters.begin(); it != mapCounters.end(); ++it)
+        strCounters += strprintf("%s%s=%.2f", strCounters.empty() ? "" : " ", it->first, (double)it->second / count);
+    std::cout << strprintf("%s,%d,%f,%f,%f,%.0f,%s\n", name, count, minTime, maxTime, average,
+                     total > 0 ? nItems / total : 0.0, strCounters);
+
+    return false;
+}
@@ -0,0 +1,46 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "ui_interface.h"
+#include "util.h"
+
+#include <iostream>
+
+CClientUIInterface uiInterface;
+CWallet* pwalletMain;
+
+void StartShutdown()
+{
+    exit(0);
+}
+
+bool ShutdownRequested()
+{
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        std::cout << "Usage: bench_mktcoin [options]\n\n"
+                  << "Options:\n"
+                  << "  -maxtime=<n>    Seconds to spend on each benchmark (default: 1)\n"
+                  << "  -utxos=<n>      Number of wallet outputs in the staking benchmarks (default: 1000)\n"
+                  << "  -blocks=<n>     Length of the synthetic chain in the staking benchmarks (default: 2000)\n";
+        return 0;
+    }
+
+    SetupEnvironment();
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+    SelectParams(CBaseChainParams::UNITTEST);
+
+    benchmark::BenchRunner::RunAll(atof(GetArg("-maxtime", "1").c_str()));
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "coins.h"
+#include "random.h"
+
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#if __GLIBC_PREREQ(2, 33)
+#define HAVE_MALLINFO2 1
+#endif
+#endif
+
+// Entries written between two flushes, and how many of them get spent again
+static const size_t CACHE_ENTRIES = 50000;
+static const size_t CACHE_SPENT = CACHE_ENTRIES / 2;
+
+namespace
+{
+//! The coins map as it was before it got a pool
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsHeapMap;
+
+#ifdef HAVE_MALLINFO2
+//! Bytes malloc has handed out and not got back; not the resident set size
+size_t HeapBytesInUse()
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+#else
+//! Without mallinfo2() the heap use isn't known and isn't reported
+size_t HeapBytesInUse()
+{
+    return 0;
+}
+#endif
+
+std::vector<uint256> MakeTxids()
+{
+    std::vector<uint256> vTxid(CACHE_ENTRIES);
+    for (size_t i = 0; i < vTxid.size(); i++)
+        vTxid[i] = GetRandHash();
+    return vTxid;
+}
+
+/**
+ * What the tip cache sees between flushes: new transactions are added, part
+ * of them spent and erased again, and the rest is written out entry by entry
+ * like BatchWrite does. Returns the heap memory held by the map at its
+ * largest, as malloc counts it: nodes, buckets and the coins in them.
+ */
+template <typename Map>
+size_t ChurnCoins(Map& map, const std::vector<uint256>& vTxid, const CCoins& coins)
+{
+    size_t nHeapBefore = HeapBytesInUse();
+    for (size_t i = 0; i < vTxid.size(); i++) {
+        CCoinsCacheEntry& entry = map[vTxid[i]];
+        entry.coins = coins;
+        entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+    }
+    size_t nUsage = HeapBytesInUse() - nHeapBefore;
+    for (size_t i = 0; i < CACHE_SPENT; i++)
+        map.erase(vTxid[i * 2]);
+    for (typename Map::iterator it = map.begin(); it != map.end();) {
+        typename Map::iterator itOld = it++;
+        map.erase(itOld);
+    }
+    return nUsage;
+}
+
+void AddHeapCounter(benchmark::State& state, size_t nUsage)
+{
+#ifdef HAVE_MALLINFO2
+    state.AddCounter("heap_kb", nUsage >> 10);
+#endif
+}
+
+CCoins MakeCoins()
+{
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 1;
+    coins.vout.resize(2);
+    for (size_t i = 0; i < coins.vout.size(); i++) {
+        coins.vout[i].nValue = 1;
+        coins.vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return coins;
+}
+}
+
+static void CoinsMap_Heap(benchmark::State& state)
+{
+    std::vector<uint256> vTxid = MakeTxids();
+    CCoins coins = MakeCoins();
+    while (state.KeepRunning()) {
+        CCoinsHeapMap map;
+        AddHeapCounter(state, ChurnCoins(map, vTxid, coins));
+        state.AddItems(vTxid.size());
+    }
+}
+
+static void CoinsMap_Pool(benchmark::State& state)
+{
+    std::vector<uint256> vTxid = MakeTxids();
+    CCoins coins = MakeCoins();
+    while (state.KeepRunning()) {
+        CPoolResource pool;
+        CCoinsMap map(0, CCoinsKeyHasher(), std::equal_to<uint256>(), CCoinsMapAllocator(&pool));
+        AddHeapCounter(state, ChurnCoins(map, vTxid, coins));
+        state.AddItems(vTxid.size());
+    }
+}
+
+BENCHMARK(CoinsMap_Heap);
+BENCHMARK(CoinsMap_Pool);
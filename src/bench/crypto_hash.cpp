@@ -0,0 +1,61 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/sha256.h"
+#include "crypto/x17.h"
+#include "hash.h"
+
+#include <vector>
+
+// Size of a serialized stake kernel, see Stake() in kernel.cpp
+static const size_t KERNEL_SIZE = 52;
+static const size_t KERNEL_BATCH = 300;
+
+static void SHA256D_Kernel(benchmark::State& state)
+{
+    std::vector<unsigned char> in(KERNEL_SIZE * KERNEL_BATCH, 0);
+    uint256 hash;
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < KERNEL_BATCH; i++)
+            hash = Hash(in.begin() + i * KERNEL_SIZE, in.begin() + (i + 1) * KERNEL_SIZE);
+        state.AddItems(KERNEL_BATCH);
+    }
+}
+
+static void SHA256D_KernelLanes(benchmark::State& state)
+{
+    std::vector<unsigned char> in(KERNEL_SIZE * KERNEL_BATCH, 0);
+    std::vector<unsigned char> out(32 * KERNEL_BATCH);
+    while (state.KeepRunning()) {
+        SHA256DOneBlock(&out[0], &in[0], KERNEL_SIZE, KERNEL_BATCH);
+        state.AddItems(KERNEL_BATCH);
+    }
+}
+
+static void HashX17_Header(benchmark::State& state)
+{
+    std::vector<unsigned char> in(80, 0);
+    while (state.KeepRunning()) {
+        HashX17(in.begin(), in.end());
+        state.AddItems(1);
+    }
+}
+
+static void HashX17_HeaderMany(benchmark::State& state)
+{
+    static const size_t HEADER_BATCH = 64;
+    std::vector<unsigned char> in(80 * HEADER_BATCH, 0);
+    std::vector<unsigned char> out(X17_OUTPUT_SIZE * HEADER_BATCH);
+    while (state.KeepRunning()) {
+        X17HashMany(&out[0], &in[0], 80, HEADER_BATCH);
+        state.AddItems(HEADER_BATCH);
+    }
+}
+
+BENCHMARK(SHA256D_Kernel);
+BENCHMARK(SHA256D_KernelLanes);
+BENCHMARK(HashX17_Header);
+BENCHMARK(HashX17_HeaderMany);
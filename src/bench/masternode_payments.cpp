@@ -0,0 +1,99 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main.h"
+#include "masternode-payments.h"
+#include "masternode.h"
+#include "random.h"
+
+#include <vector>
+
+static const unsigned int BENCH_BLOCK_SPACING = 60;
+
+namespace
+{
+/**
+ * A chain as long as the payment window of nMasternodes, with every block's
+ * payee voted in, the way mnw messages leave masternodePayments.
+ */
+class CPaidMasternodes
+{
+    std::vector<CBlockIndex*> vIndex;
+
+public:
+    std::vector<CMasternode> vMasternodes;
+    int nMaxBlocks;
+
+    explicit CPaidMasternodes(int nMasternodes) : vMasternodes(nMasternodes), nMaxBlocks(nMasternodes * 1.25)
+    {
+        for (int i = 0; i < nMasternodes; i++) {
+            std::vector<unsigned char> vch(33);
+            vch[0] = 0x02;
+            uint256 hash = GetRandHash();
+            std::copy(hash.begin(), hash.end(), vch.begin() + 1);
+            vMasternodes[i].pubKeyCollateralAddress = CPubKey(vch);
+            vMasternodes[i].vin = CTxIn(GetRandHash(), 0);
+        }
+
+        CBlockIndex* pindexPrev = NULL;
+        for (int nHeight = 0; nHeight <= nMaxBlocks; nHeight++) {
+            CBlockIndex* pindex = new CBlockIndex();
+            pindex->nHeight = nHeight;
+            pindex->nTime = 1500000000 + nHeight * BENCH_BLOCK_SPACING;
+            pindex->pprev = pindexPrev;
+            BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(GetRandHash(), pindex)).first;
+            pindex->phashBlock = &((*mi).first);
+            pindex->BuildSkip();
+            vIndex.push_back(pindex);
+            pindexPrev = pindex;
+
+            // A fifth of the masternodes were not paid within the window
+            if (nHeight == 0 || nHeight % 5 == 0) continue;
+            CMasternodeBlockPayees& payees = masternodePayments.mapMasternodeBlocks[nHeight];
+            payees.nBlockHeight = nHeight;
+            CScript payee = GetScriptForDestination(vMasternodes[nHeight % nMasternodes].pubKeyCollateralAddress.GetID());
+            payees.AddPayee(payee, MNPAYMENTS_SIGNATURES_TOTAL);
+        }
+        chainActive.SetTip(pindexPrev);
+        masternodePayments.RebuildPayeeHeights();
+    }
+
+    ~CPaidMasternodes()
+    {
+        masternodePayments.Clear();
+        chainActive.SetTip(NULL);
+        mapBlockIndex.clear();
+        for (unsigned int i = 0; i < vIndex.size(); i++)
+            delete vIndex[i];
+    }
+};
+}
+
+// The last-paid scan GetNextMasternodeInQueueForPayment does for every block
+static void MasternodeLastPaid(benchmark::State& state, int nMasternodes)
+{
+    CPaidMasternodes paid(nMasternodes);
+    while (state.KeepRunning()) {
+        int64_t nPaid = 0;
+        for (unsigned int i = 0; i < paid.vMasternodes.size(); i++)
+            if (paid.vMasternodes[i].GetLastPaid(paid.nMaxBlocks) != 0) nPaid++;
+        state.AddItems(paid.vMasternodes.size());
+        state.AddCounter("paid", nPaid);
+    }
+}
+
+static void MasternodeLastPaid_1k(benchmark::State& state)
+{
+    MasternodeLastPaid(state, 1000);
+}
+
+static void MasternodeLastPaid_10k(benchmark::State& state)
+{
+    MasternodeLastPaid(state, 10000);
+}
+
+BENCHMARK(MasternodeLastPaid_1k);
+BENCHMARK(MasternodeLastPaid_10k);
@@ -0,0 +1,276 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "kernel.h"
+#include "main.h"
+#include "random.h"
+#include "stakeinput.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+// Compact target of 1 per coin day: no kernel ever hits, so every round scans the full window
+static const unsigned int BENCH_STAKE_BITS = 0x01010000;
+static const unsigned int BENCH_BLOCK_SPACING = 60;
+// Outputs are confirmed far enough below the tip to have a kernel stake modifier
+static const int BENCH_MODIFIER_DEPTH = 100;
+
+namespace
+{
+/** In-memory chain registered in mapBlockIndex/chainActive, with real stake modifiers. */
+class CSyntheticChain
+{
+    std::vector<CBlockIndex*> vIndex;
+
+public:
+    explicit CSyntheticChain(int nBlocks)
+    {
+        CBlockIndex* pindexPrev = NULL;
+        for (int nHeight = 0; nHeight < nBlocks; nHeight++) {
+            CBlockIndex* pindex = new CBlockIndex();
+            pindex->nHeight = nHeight;
+            pindex->nTime = 1500000000 + nHeight * BENCH_BLOCK_SPACING;
+            pindex->pprev = pindexPrev;
+            if (nHeight > 0)
+                pindex->SetProofOfStake();
+            BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(GetRandHash(), pindex)).first;
+            pindex->phashBlock = &((*mi).first);
+            pindex->BuildSkip();
+
+            uint64_t nStakeModifier = 0;
+            bool fGeneratedStakeModifier = false;
+            ComputeNextStakeModifier(pindexPrev, nStakeModifier, fGeneratedStakeModifier);
+            pindex->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+
+            vIndex.push_back(pindex);
+            pindexPrev = pindex;
+        }
+        chainActive.SetTip(pindexPrev);
+    }
+
+    ~CSyntheticChain()
+    {
+        chainActive.SetTip(NULL);
+        mapBlockIndex.clear();
+        for (unsigned int i = 0; i < vIndex.size(); i++)
+            delete vIndex[i];
+    }
+
+    CBlockIndex* operator[](int nHeight) const { return vIndex[nHeight]; }
+    int Height() const { return vIndex.size() - 1; }
+};
+
+/**
+ * On-disk txindex for the uncached staking round: each output is written to
+ * a block file of a temporary datadir and indexed, so CPivStake resolves it
+ * the way the wallet does, through ReadTxIndex and a block file read.
+ */
+class CBenchTxIndex
+{
+    boost::filesystem::path pathTemp;
+    CDiskBlockPos posNext;
+    bool fTxIndexPrev;
+
+public:
+    CBenchTxIndex() : posNext(0, 0), fTxIndexPrev(fTxIndex)
+    {
+        pathTemp = GetTempPath() / strprintf("bench_mktcoin_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+        boost::filesystem::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+        ClearDatadirCache();
+        pblocktree = new CBlockTreeDB(1 << 20, false, true);
+        fTxIndex = true;
+    }
+
+    ~CBenchTxIndex()
+    {
+        fTxIndex = fTxIndexPrev;
+        delete pblocktree;
+        pblocktree = NULL;
+        mapArgs.erase("-datadir");
+        ClearDatadirCache();
+        boost::filesystem::remove_all(pathTemp);
+    }
+
+    /** Write a block holding tx on top of pindex->pprev and map its hash to pindex */
+    void Add(const CTransaction& tx, CBlockIndex* pindex)
+    {
+        CBlock block;
+        block.hashPrevBlock = pindex->pprev->GetBlockHash();
+        block.nTime = pindex->nTime;
+        block.vtx.push_back(tx);
+        block.hashMerkleRoot = block.BuildMerkleTree();
+
+        CDiskBlockPos pos = posNext;
+        if (!WriteBlockToDisk(block, pos))
+            throw std::runtime_error("CBenchTxIndex::Add : WriteBlockToDisk failed");
+        posNext.nPos = pos.nPos + ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+
+        std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+        vPos.push_back(std::make_pair(tx.GetHash(), CDiskTxPos(pos, GetSizeOfCompactSize(block.vtx.size()))));
+        if (!pblocktree->WriteTxIndex(vPos))
+            throw std::runtime_error("CBenchTxIndex::Add : WriteTxIndex failed");
+
+        // The synthetic chain has random block hashes; also find pindex under the written one
+        mapBlockIndex.insert(std::make_pair(block.GetHash(), pindex));
+    }
+};
+
+/**
+ * Stake input that resolves its block and modifier on every use, the way
+ * CPivStake does without the wallet cache, timing the txindex lookups.
+ */
+class CUncachedStake : public CPivStake
+{
+    int64_t& nLookups;
+    int64_t& nLookupMicros;
+
+public:
+    CUncachedStake(int64_t& nLookupsIn, int64_t& nLookupMicrosIn) : nLookups(nLookupsIn), nLookupMicros(nLookupMicrosIn) {}
+
+    CBlockIndex* GetIndexFrom() override
+    {
+        int64_t nStart = GetTimeMicros();
+        CBlockIndex* pindex = CPivStake::GetIndexFrom();
+        nLookupMicros += GetTimeMicros() - nStart;
+        nLookups++;
+        return pindex;
+    }
+};
+
+/** A synthetic wallet: nOutputs stake inputs confirmed at random depths of the chain. */
+void MakeStakeInputs(const CSyntheticChain& chain, CBenchTxIndex* pTxIndex, int64_t& nLookups, int64_t& nLookupMicros, std::list<std::unique_ptr<CStakeInput> >& listInputs)
+{
+    int nOutputs = std::max((int64_t)1, GetArg("-utxos", 1000));
+    int nMaxHeight = chain.Height() - BENCH_MODIFIER_DEPTH;
+    for (int i = 0; i < nOutputs; i++) {
+        CMutableTransaction tx;
+        tx.vin.push_back(CTxIn(GetRandHash(), 0));
+        tx.vout.push_back(CTxOut((1 + insecure_rand() % 10000) * COIN, CScript()));
+
+        CBlockIndex* pindexFrom = chain[1 + insecure_rand() % nMaxHeight];
+        CPivStake* input;
+        if (!pTxIndex) {
+            int nStakeModifierHeight = 0;
+            int64_t nStakeModifierTime = 0;
+            uint64_t nStakeModifier = 0;
+            GetKernelStakeModifier(pindexFrom->GetBlockHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false);
+            input = new CPivStake();
+            input->SetCachedMetadata(pindexFrom, nStakeModifier);
+        } else {
+            pTxIndex->Add(CTransaction(tx), pindexFrom);
+            input = new CUncachedStake(nLookups, nLookupMicros);
+        }
+        input->SetInput(CTransaction(tx), 0);
+        listInputs.emplace_back(input);
+    }
+}
+
+/** One kernel search pass over every input, as done by CWallet::CreateCoinStake. */
+void StakeRound(benchmark::State& state, bool fCached)
+{
+    CSyntheticChain chain(std::max((int64_t)BENCH_MODIFIER_DEPTH + 2, GetArg("-blocks", 2000)));
+    std::unique_ptr<CBenchTxIndex> pTxIndex(fCached ? NULL : new CBenchTxIndex());
+    int64_t nLookups = 0;
+    int64_t nLookupMicros = 0;
+    std::list<std::unique_ptr<CStakeInput> > listInputs;
+    LOCK(cs_main);
+    MakeStakeInputs(chain, pTxIndex.get(), nLookups, nLookupMicros, listInputs);
+
+    while (state.KeepRunning()) {
+        for (std::unique_ptr<CStakeInput>& stakeInput : listInputs) {
+            CBlockIndex* pindex = stakeInput->GetIndexFrom();
+            unsigned int nTxNewTime = chainActive.Tip()->GetBlockTime() + BENCH_BLOCK_SPACING;
+            uint256 hashProofOfStake = 0;
+            Stake(stakeInput.get(), BENCH_STAKE_BITS, pindex->GetBlockTime(), nTxNewTime, hashProofOfStake);
+        }
+        // Stake() hashes 300 timestamps per input
+        state.AddItems(listInputs.size() * 300);
+        if (!fCached) {
+            state.AddCounter("txindex_reads", nLookups);
+            state.AddCounter("txindex_read_us", nLookupMicros);
+        }
+        nLookups = 0;
+        nLookupMicros = 0;
+    }
+}
+}
+
+static void CreateCoinStakeRound(benchmark::State& state)
+{
+    StakeRound(state, true);
+}
+
+static void CreateCoinStakeRoundUncached(benchmark::State& state)
+{
+    StakeRound(state, false);
+}
+
+static void CheckStakeKernel(benchmark::State& state)
+{
+    CDataStream ssUniqueID(SER_NETWORK, 0);
+    ssUniqueID << (unsigned int)0 << GetRandHash();
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(BENCH_STAKE_BITS);
+    unsigned int nTimeTx = 1500000000;
+    uint256 hashProofOfStake;
+    while (state.KeepRunning()) {
+        CheckStake(ssUniqueID, 100 * COIN, 0x1234567890abcdefULL, bnTargetPerCoinDay, 1400000000, nTimeTx, hashProofOfStake);
+        state.AddItems(1);
+    }
+}
+
+static void KernelStakeModifierLookup(benchmark::State& state, bool fMemoized)
+{
+    CSyntheticChain chain(std::max((int64_t)BENCH_MODIFIER_DEPTH + 2, GetArg("-blocks", 2000)));
+    int nMaxHeight = chain.Height() - BENCH_MODIFIER_DEPTH;
+    LOCK(cs_main);
+    while (state.KeepRunning()) {
+        int nStakeModifierHeight = 0;
+        int64_t nStakeModifierTime = 0;
+        uint64_t nStakeModifier = 0;
+        CBlockIndex* pindexFrom = chain[1 + insecure_rand() % nMaxHeight];
+        if (!fMemoized)
+            pindexFrom->pindexKernelModifier = NULL;
+        GetKernelStakeModifier(pindexFrom->GetBlockHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false);
+        state.AddItems(1);
+    }
+}
+
+static void GetKernelStakeModifierWalk(benchmark::State& state)
+{
+    KernelStakeModifierLookup(state, false);
+}
+
+static void GetKernelStakeModifierMemoized(benchmark::State& state)
+{
+    KernelStakeModifierLookup(state, true);
+}
+
+static void ComputeNextStakeModifierBlock(benchmark::State& state)
+{
+    CSyntheticChain chain(std::max((int64_t)BENCH_MODIFIER_DEPTH + 2, GetArg("-blocks", 2000)));
+    LOCK(cs_main);
+    while (state.KeepRunning()) {
+        uint64_t nStakeModifier = 0;
+        bool fGeneratedStakeModifier = false;
+        ComputeNextStakeModifier(chain[1 + insecure_rand() % chain.Height()], nStakeModifier, fGeneratedStakeModifier);
+        state.AddItems(1);
+    }
+}
+
+BENCHMARK(CreateCoinStakeRound);
+BENCHMARK(CreateCoinStakeRoundUncached);
+BENCHMARK(CheckStakeKernel);
+BENCHMARK(GetKernelStakeModifierWalk);
+BENCHMARK(GetKernelStakeModifierMemoized);
+BENCHMARK(ComputeNextStakeModifierBlock);
@@ -0,0 +1,190 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockprefetch.h"
+
+#include "chain.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "util.h"
+
+#include <deque>
+#include <set>
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView* viewIn) : CCoinsViewBacked(viewIn), nGeneration(0) {}
+
+bool CCoinsViewPrefetch::GetCoins(const uint256& txid, CCoins& coins) const
+{
+    {
+        LOCK(cs);
+        std::map<uint256, CCoins>::iterator it = mapPrefetched.find(txid);
+        if (it != mapPrefetched.end()) {
+            // The cache above keeps it from now on
+            coins.swap(it->second);
+            mapPrefetched.erase(it);
+            return true;
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewPrefetch::HaveCoins(const uint256& txid) const
+{
+    {
+        LOCK(cs);
+        if (mapPrefetched.count(txid))
+            return true;
+    }
+    return base->HaveCoins(txid);
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    // Hold the lock over the write: a read started before it finishes can't be
+    // stored, as its generation is outdated.
+    LOCK(cs);
+    mapPrefetched.clear();
+    nGeneration++;
+    return base->BatchWrite(mapCoins, hashBlock);
+}
+
+void CCoinsViewPrefetch::Prefetch(const std::vector<uint256>& vTxid)
+{
+    BOOST_FOREACH (const uint256& txid, vTxid) {
+        uint64_t nReadGeneration;
+        {
+            LOCK(cs);
+            if (mapPrefetched.count(txid))
+                continue;
+            nReadGeneration = nGeneration;
+        }
+        CCoins coins;
+        if (!base->GetCoins(txid, coins) || coins.IsPruned())
+            continue;
+        LOCK(cs);
+        if (nReadGeneration != nGeneration)
+            continue;
+        if (mapPrefetched.size() >= MAX_PREFETCHED_COINS)
+            mapPrefetched.clear();
+        mapPrefetched[txid].swap(coins);
+    }
+}
+
+namespace
+{
+//! Blocks waiting to be read ahead; only the next few are worth it
+static const size_t MAX_QUEUED_BLOCKS = 2;
+
+boost::mutex csPrefetch;
+boost::condition_variable condPrefetch;
+boost::thread* pthreadPrefetch = NULL;
+CCoinsViewPrefetch* pcoinsPrefetch = NULL;
+bool fStopPrefetch = false;
+std::deque<const CBlockIndex*> queuePrefetch;
+//! The last block read ahead, waiting for ConnectTip
+uint256 hashPrefetchedBlock;
+CBlock blockPrefetched;
+
+void ThreadBlockPrefetch()
+{
+    while (true) {
+        const CBlockIndex* pindex;
+        {
+            boost::unique_lock<boost::mutex> lock(csPrefetch);
+            while (!fStopPrefetch && queuePrefetch.empty())
+                condPrefetch.wait(lock);
+            if (fStopPrefetch)
+                return;
+            pindex = queuePrefetch.front();
+            queuePrefetch.pop_front();
+        }
+
+        // The same read, and checks, ConnectTip would do itself
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex))
+            continue;
+
+        // Outputs created in the block itself are not in the database yet, so
+        // they start out in the set that also weeds out repeated txids.
+        std::set<uint256> setInBlock;
+        BOOST_FOREACH (const CTransaction& tx, block.vtx)
+            setInBlock.insert(tx.GetHash());
+        std::vector<uint256> vTxid;
+        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+            if (tx.IsCoinBase())
+                continue;
+            BOOST_FOREACH (const CTxIn& txin, tx.vin)
+                if (setInBlock.insert(txin.prevout.hash).second)
+                    vTxid.push_back(txin.prevout.hash);
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(csPrefetch);
+            hashPrefetchedBlock = pindex->GetBlockHash();
+            std::swap(blockPrefetched, block);
+        }
+
+        pcoinsPrefetch->Prefetch(vTxid);
+        LogPrint("bench", "Prefetched block %s with %u input transactions\n", pindex->GetBlockHash().ToString(), vTxid.size());
+    }
+}
+}
+
+void StartBlockPrefetch(CCoinsViewPrefetch* view)
+{
+    assert(pthreadPrefetch == NULL);
+    pcoinsPrefetch = view;
+    fStopPrefetch = false;
+    pthreadPrefetch = new boost::thread(boost::bind(&TraceThread<void (*)()>, "prefetch", &ThreadBlockPrefetch));
+}
+
+void StopBlockPrefetch()
+{
+    if (pthreadPrefetch == NULL)
+        return;
+    {
+        boost::unique_lock<boost::mutex> lock(csPrefetch);
+        fStopPrefetch = true;
+    }
+    condPrefetch.notify_all();
+    pthreadPrefetch->join();
+
+    boost::unique_lock<boost::mutex> lock(csPrefetch);
+    delete pthreadPrefetch;
+    pthreadPrefetch = NULL;
+    pcoinsPrefetch = NULL;
+    queuePrefetch.clear();
+    hashPrefetchedBlock = 0;
+    blockPrefetched.SetNull();
+}
+
+void PrefetchBlock(const CBlockIndex* pindex)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csPrefetch);
+        if (pthreadPrefetch == NULL || hashPrefetchedBlock == pindex->GetBlockHash())
+            return;
+        for (size_t i = 0; i < queuePrefetch.size(); i++)
+            if (queuePrefetch[i] == pindex)
+                return;
+        if (queuePrefetch.size() >= MAX_QUEUED_BLOCKS)
+            queuePrefetch.pop_front();
+        queuePrefetch.push_back(pindex);
+    }
+    condPrefetch.notify_one();
+}
+
+bool TakePrefetchedBlock(const uint256& hash, CBlock& block)
+{
+    boost::unique_lock<boost::mutex> lock(csPrefetch);
+    if (hashPrefetchedBlock != hash)
+        return false;
+    std::swap(block, blockPrefetched);
+    blockPrefetched.SetNull();
+    hashPrefetchedBlock = 0;
+    return true;
+}
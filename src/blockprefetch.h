@@ -0,0 +1,56 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKPREFETCH_H
+#define BITCOIN_BLOCKPREFETCH_H
+
+#include "coins.h"
+#include "sync.h"
+
+#include <map>
+#include <vector>
+
+class CBlock;
+class CBlockIndex;
+
+/** Default for -blockprefetch */
+static const bool DEFAULT_BLOCK_PREFETCH = true;
+
+/**
+ * CCoinsView layer below the coins tip that serves the coins read ahead by the
+ * prefetch thread. Each entry is handed out once, and every write to the base
+ * drops all of them, so they never differ from what the base holds.
+ */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    //! Cap on the entries held; the tip asks for only part of what is read ahead
+    static const size_t MAX_PREFETCHED_COINS = 50000;
+
+    mutable CCriticalSection cs;
+    mutable std::map<uint256, CCoins> mapPrefetched;
+    //! Bumped by every write, so reads from the base that overlap one are dropped
+    uint64_t nGeneration;
+
+public:
+    CCoinsViewPrefetch(CCoinsView* viewIn);
+
+    bool GetCoins(const uint256& txid, CCoins& coins) const;
+    bool HaveCoins(const uint256& txid) const;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+
+    //! Read the coins of the given transactions from the base and hold them
+    void Prefetch(const std::vector<uint256>& vTxid);
+};
+
+/** Start the thread reading blocks (and their inputs into view) ahead of ConnectTip */
+void StartBlockPrefetch(CCoinsViewPrefetch* view);
+/** Stop the prefetch thread; must be called before view is deleted */
+void StopBlockPrefetch();
+/** Queue the block of pindex (which must have its data) to be read ahead, together with the coins it spends */
+void PrefetchBlock(const CBlockIndex* pindex);
+/** Take the block with the given hash if it was read ahead. Returns false if it wasn't. */
+bool TakePrefetchedBlock(const uint256& hash, CBlock& block);
+
+#endif // BITCOIN_BLOCKPREFETCH_H
@@ -12,6 +12,7 @@
 #include "uint256.h"
 #include "util.h"
 
+#include <atomic>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -98,6 +99,27 @@ enum BlockStatus {
     BLOCK_FAILED_MASK = BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 };
 
+/** A flag that is set under a lock and read without one, with release/acquire
+ *  ordering. Copies take a snapshot, so classes holding one stay copyable. */
+class CPublishedFlag
+{
+private:
+    std::atomic<bool> fValue;
+
+public:
+    CPublishedFlag() : fValue(false) {}
+    CPublishedFlag(const CPublishedFlag& other) : fValue(other.Get()) {}
+
+    CPublishedFlag& operator=(const CPublishedFlag& other)
+    {
+        Set(other.Get());
+        return *this;
+    }
+
+    bool Get() const { return fValue.load(std::memory_order_acquire); }
+    void Set(bool fValueIn) { fValue.store(fValueIn, std::memory_order_release); }
+};
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -165,6 +187,16 @@ public:
     int64_t nMint;
     int64_t nMoneySupply;
 
+    //! (memoized, stored separately in the block tree db) block whose stake modifier is used by
+    //! kernels spending coins confirmed in this block; only meaningful while both are in chainActive
+    CBlockIndex* pindexKernelModifier;
+
+    //! (memoized, stored separately in the block tree db) X17 hash of a proof-of-work header, already
+    //! checked against nBits; only valid once fHavePoWHash is set. Written once under cs_main before
+    //! the flag is published, so readers that see the flag may use it without cs_main.
+    uint256 hashPoW;
+    CPublishedFlag fHavePoWHash;
+
     //! block header
     int nVersion;
     uint256 hashMerkleRoot;
@@ -197,6 +229,9 @@ public:
         nStakeModifierChecksum = 0;
         prevoutStake.SetNull();
         nStakeTime = 0;
+        pindexKernelModifier = NULL;
+        hashPoW = uint256();
+        fHavePoWHash.Set(false);
 
         nVersion = 0;
         hashMerkleRoot = uint256();
@@ -380,6 +415,19 @@ public:
         return false;
     }
 
+    //! Whether hashPoW holds the verified proof-of-work hash. Does not need cs_main.
+    bool HavePoWHash() const
+    {
+        return fHavePoWHash.Get();
+    }
+
+    //! Record the verified proof-of-work hash of the header. Called once, under cs_main.
+    void SetPoWHash(const uint256& hash)
+    {
+        hashPoW = hash;
+        fHavePoWHash.Set(true);
+    }
+
     //! Build the skiplist pointer for this entry.
     void BuildSkip();
 
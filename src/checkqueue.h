@@ -65,6 +65,9 @@ private:
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Held by the CCheckQueueControl using the queue, so callers take turns
+    boost::mutex mutexControl;
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
@@ -166,11 +169,15 @@ public:
         boost::unique_lock<boost::mutex> lock(mutex);
         return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
     }
+
+    friend class CCheckQueueControl<T>;
 };
 
 /** 
  * RAII-style controller object for a CCheckQueue that guarantees the passed
- * queue is finished before continuing.
+ * queue is finished before continuing. The queue is shared by block connection,
+ * mempool acceptance and block creation; a controller waits for the previous
+ * one to finish before taking the queue.
  */
 template <typename T>
 class CCheckQueueControl
@@ -184,6 +191,7 @@ public:
     {
         // passed queue is supposed to be unused, or NULL
         if (pqueue != NULL) {
+            pqueue->mutexControl.lock();
             bool isIdle = pqueue->IsIdle();
             assert(isIdle);
         }
@@ -208,6 +216,8 @@ public:
     {
         if (!fDone)
             Wait();
+        if (pqueue != NULL)
+            pqueue->mutexControl.unlock();
     }
 };
 
@@ -7,6 +7,7 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "memusage.h"
 #include "script/standard.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -283,6 +284,15 @@ public:
                 return false;
         return true;
     }
+
+    //! heap memory owned by this CCoins: the outputs and their scripts
+    size_t DynamicMemoryUsage() const
+    {
+        size_t ret = memusage::DynamicUsage(vout);
+        BOOST_FOREACH (const CTxOut& out, vout)
+            ret += memusage::DynamicUsage(out.scriptPubKey);
+        return ret;
+    }
 };
 
 class CCoinsKeyHasher
@@ -316,7 +326,8 @@ struct CCoinsCacheEntry {
     CCoinsCacheEntry() : coins(), flags(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+typedef pool_allocator<std::pair<const uint256, CCoinsCacheEntry> > CCoinsMapAllocator;
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>, CCoinsMapAllocator> CCoinsMap;
 
 struct CCoinsStats {
     int nHeight;
@@ -398,7 +409,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -419,8 +431,13 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    /* Pool for the nodes of cacheCoins, emptied in one go by Flush(). */
+    CPoolResource cacheCoinsPool;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView* baseIn);
     ~CCoinsViewCache();
@@ -453,9 +470,21 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base like Flush(),
+     * but keep the modified entries that still have unspent outputs cached
+     * (as unmodified), since recently created outputs are the ones most likely
+     * to be spent next. If fDropUnmodified is set, entries that were only read
+     * from the base since the last flush are evicted; otherwise they are kept.
+     */
+    bool PartialFlush(bool fDropUnmodified);
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+
     /** 
      * Amount of mktcoins coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -471,14 +500,21 @@ public:
 
     //! Return priority of tx at height nHeight
     double GetPriority(const CTransaction& tx, int nHeight) const;
+    //! Same, also returning the value of the inputs in the chain, which keeps adding to the priority
+    double GetPriority(const CTransaction& tx, int nHeight, CAmount& inChainInputValue) const;
 
     const CTxOut& GetOutputFor(const CTxIn& input) const;
 
     friend class CCoinsModifier;
 
 private:
+    CCoinsViewCache(const CCoinsViewCache&);
+    CCoinsViewCache& operator=(const CCoinsViewCache&);
+
     CCoinsMap::iterator FetchCoins(const uint256& txid);
     CCoinsMap::const_iterator FetchCoins(const uint256& txid) const;
+    //! Drop all entries and give the memory of the map back to the system
+    void ReleaseCache();
 };
 
 #endif // BITCOIN_COINS_H
@@ -45,6 +45,15 @@
 #include <unistd.h>
 #endif
 
+#ifndef WIN32
+// poll() has no FD_SETSIZE limit; on Linux the socket handler uses epoll on top of it
+#define USE_POLL
+#include <poll.h>
+#ifdef __linux__
+#define USE_EPOLL
+#endif
+#endif
+
 #ifdef WIN32
 #define MSG_DONTWAIT 0
 #else
@@ -92,7 +101,7 @@ size_t strnlen_int(const char* start, size_t max_len);
 
 bool static inline IsSelectableSocket(SOCKET s)
 {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_POLL)
     return true;
 #else
     return (s < FD_SETSIZE);
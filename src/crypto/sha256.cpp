@@ -6,6 +6,7 @@
 
 #include "crypto/common.h"
 
+#include <assert.h>
 #include <string.h>
 
 // Internal implementation code.
@@ -187,3 +188,171 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+namespace
+{
+/// Multi-lane SHA-256 of single-block messages, one message per vector lane.
+namespace sha256d_lanes
+{
+static const size_t MAX_LEN = 55;
+
+#if defined(__GNUC__)
+#define SHA256D_LANES_INLINE inline __attribute__((always_inline))
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+typedef uint32_t v8u32 __attribute__((vector_size(32)));
+
+// The round functions are macros rather than functions taking and returning V: a 32-byte
+// vector passed by value in code built without AVX has a different ABI (-Wpsabi).
+#define SHA256D_LANES_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA256D_LANES_CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define SHA256D_LANES_MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define SHA256D_LANES_SIGMA0(x) (SHA256D_LANES_ROR(x, 2) ^ SHA256D_LANES_ROR(x, 13) ^ SHA256D_LANES_ROR(x, 22))
+#define SHA256D_LANES_SIGMA1(x) (SHA256D_LANES_ROR(x, 6) ^ SHA256D_LANES_ROR(x, 11) ^ SHA256D_LANES_ROR(x, 25))
+#define SHA256D_LANES_sigma0(x) (SHA256D_LANES_ROR(x, 7) ^ SHA256D_LANES_ROR(x, 18) ^ ((x) >> 3))
+#define SHA256D_LANES_sigma1(x) (SHA256D_LANES_ROR(x, 17) ^ SHA256D_LANES_ROR(x, 19) ^ ((x) >> 10))
+
+/** Perform one SHA-256 transformation on every lane. w[] is used as the message schedule. */
+template <typename V>
+SHA256D_LANES_INLINE void Transform(V* s, V* w)
+{
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16)
+            w[i & 15] += SHA256D_LANES_sigma1(w[(i + 14) & 15]) + w[(i + 9) & 15] + SHA256D_LANES_sigma0(w[(i + 1) & 15]);
+        V t1 = h + SHA256D_LANES_SIGMA1(e) + SHA256D_LANES_CH(e, f, g) + K[i] + w[i & 15];
+        V t2 = SHA256D_LANES_SIGMA0(a) + SHA256D_LANES_MAJ(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    s[0] += a;
+    s[1] += b;
+    s[2] += c;
+    s[3] += d;
+    s[4] += e;
+    s[5] += f;
+    s[6] += g;
+    s[7] += h;
+}
+
+#undef SHA256D_LANES_ROR
+#undef SHA256D_LANES_CH
+#undef SHA256D_LANES_MAJ
+#undef SHA256D_LANES_SIGMA0
+#undef SHA256D_LANES_SIGMA1
+#undef SHA256D_LANES_sigma0
+#undef SHA256D_LANES_sigma1
+
+template <typename V>
+SHA256D_LANES_INLINE void Initialize(V* s)
+{
+    static const uint32_t iv[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+    for (int i = 0; i < 8; i++)
+        s[i] = V{} + iv[i];
+}
+
+/** Double SHA-256 of sizeof(V)/4 single-block messages at once. */
+template <typename V>
+SHA256D_LANES_INLINE void HashLanes(unsigned char* out, const unsigned char* in, size_t nLen)
+{
+    static const int LANES = sizeof(V) / 4;
+    V s[8], w[16];
+
+    // Pad every message into its own block and transpose the words into the lanes
+    unsigned char block[64];
+    for (int lane = 0; lane < LANES; lane++) {
+        memcpy(block, in + lane * nLen, nLen);
+        memset(block + nLen, 0, 64 - nLen);
+        block[nLen] = 0x80;
+        WriteBE64(block + 56, (uint64_t)nLen << 3);
+        for (int i = 0; i < 16; i++)
+            w[i][lane] = ReadBE32(block + 4 * i);
+    }
+    Initialize(s);
+    Transform(s, w);
+
+    // Second round hashes the 32-byte digest, already in big-endian word order
+    for (int i = 0; i < 8; i++)
+        w[i] = s[i];
+    w[8] = V{} + 0x80000000ul;
+    for (int i = 9; i < 15; i++)
+        w[i] = V{};
+    w[15] = V{} + 256;
+    Initialize(s);
+    Transform(s, w);
+
+    for (int lane = 0; lane < LANES; lane++)
+        for (int i = 0; i < 8; i++)
+            WriteBE32(out + lane * 32 + 4 * i, s[i][lane]);
+}
+
+void HashLanes4(unsigned char* out, const unsigned char* in, size_t nLen)
+{
+    HashLanes<v4u32>(out, in, nLen);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256D_LANES_AVX2
+__attribute__((target("avx2"))) void HashLanes8(unsigned char* out, const unsigned char* in, size_t nLen)
+{
+    HashLanes<v8u32>(out, in, nLen);
+}
+
+bool HaveAVX2()
+{
+    static const bool fAVX2 = __builtin_cpu_supports("avx2");
+    return fAVX2;
+}
+#endif
+#endif // __GNUC__
+
+} // namespace sha256d_lanes
+} // namespace
+
+void SHA256DOneBlock(unsigned char* out, const unsigned char* in, size_t nLen, size_t nBlocks)
+{
+    assert(nLen <= sha256d_lanes::MAX_LEN);
+#if defined(SHA256D_LANES_AVX2)
+    if (sha256d_lanes::HaveAVX2()) {
+        while (nBlocks >= 8) {
+            sha256d_lanes::HashLanes8(out, in, nLen);
+            out += 8 * 32;
+            in += 8 * nLen;
+            nBlocks -= 8;
+        }
+    }
+#endif
+#if defined(__GNUC__)
+    while (nBlocks >= 4) {
+        sha256d_lanes::HashLanes4(out, in, nLen);
+        out += 4 * 32;
+        in += 4 * nLen;
+        nBlocks -= 4;
+    }
+#endif
+    // Remaining messages go through the scalar implementation
+    unsigned char buf[CSHA256::OUTPUT_SIZE];
+    while (nBlocks > 0) {
+        CSHA256().Write(in, nLen).Finalize(buf);
+        CSHA256().Write(buf, sizeof(buf)).Finalize(out);
+        out += 32;
+        in += nLen;
+        nBlocks--;
+    }
+}
@@ -25,4 +25,12 @@ public:
     CSHA256& Reset();
 };
 
+/**
+ * Compute the double SHA-256 of nBlocks messages of nLen bytes each, stored
+ * back to back in in[]. Every message must fit in a single padded block
+ * (nLen <= 55). The 32-byte results are written back to back into out[].
+ * Several messages are hashed in parallel SIMD lanes where the CPU allows it.
+ */
+void SHA256DOneBlock(unsigned char* out, const unsigned char* in, size_t nLen, size_t nBlocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
@@ -0,0 +1,249 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/x17.h"
+
+#include "crypto/sph_blake.h"
+#include "crypto/sph_bmw.h"
+#include "crypto/sph_cubehash.h"
+#include "crypto/sph_echo.h"
+#include "crypto/sph_fugue.h"
+#include "crypto/sph_groestl.h"
+#include "crypto/sph_hamsi.h"
+#include "crypto/sph_haval.h"
+#include "crypto/sph_jh.h"
+#include "crypto/sph_keccak.h"
+#include "crypto/sph_luffa.h"
+#include "crypto/sph_sha2.h"
+#include "crypto/sph_shabal.h"
+#include "crypto/sph_shavite.h"
+#include "crypto/sph_simd.h"
+#include "crypto/sph_skein.h"
+#include "crypto/sph_whirlpool.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X17_AESNI
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+namespace
+{
+/** Any of the sph contexts used by the chain, so every round can share one buffer. */
+union X17Context {
+    sph_blake512_context blake;
+    sph_bmw512_context bmw;
+    sph_groestl512_context groestl;
+    sph_skein512_context skein;
+    sph_jh512_context jh;
+    sph_keccak512_context keccak;
+    sph_luffa512_context luffa;
+    sph_cubehash512_context cubehash;
+    sph_shavite512_context shavite;
+    sph_simd512_context simd;
+    sph_echo512_context echo;
+    sph_hamsi512_context hamsi;
+    sph_fugue512_context fugue;
+    sph_shabal512_context shabal;
+    sph_whirlpool_context whirlpool;
+    sph_sha512_context sha2;
+    sph_haval256_5_context haval;
+};
+
+struct X17Round {
+    size_t nContextSize;
+    void (*init)(void* cc);
+    void (*write)(void* cc, const void* data, size_t len);
+    void (*close)(void* cc, void* dst);
+};
+
+#define X17_ROUND(ctx, name) { sizeof(ctx), name##_init, name, name##_close }
+
+/** The X17 chain, in order. Each round hashes the 64-byte output of the previous one. */
+const X17Round rounds[] = {
+    X17_ROUND(sph_blake512_context, sph_blake512),
+    X17_ROUND(sph_bmw512_context, sph_bmw512),
+    X17_ROUND(sph_groestl512_context, sph_groestl512),
+    X17_ROUND(sph_skein512_context, sph_skein512),
+    X17_ROUND(sph_jh512_context, sph_jh512),
+    X17_ROUND(sph_keccak512_context, sph_keccak512),
+    X17_ROUND(sph_luffa512_context, sph_luffa512),
+    X17_ROUND(sph_cubehash512_context, sph_cubehash512),
+    X17_ROUND(sph_shavite512_context, sph_shavite512),
+    X17_ROUND(sph_simd512_context, sph_simd512),
+    X17_ROUND(sph_echo512_context, sph_echo512),
+    X17_ROUND(sph_hamsi512_context, sph_hamsi512),
+    X17_ROUND(sph_fugue512_context, sph_fugue512),
+    X17_ROUND(sph_shabal512_context, sph_shabal512),
+    X17_ROUND(sph_whirlpool_context, sph_whirlpool),
+    X17_ROUND(sph_sha512_context, sph_sha512),
+    X17_ROUND(sph_haval256_5_context, sph_haval256_5),
+};
+
+#undef X17_ROUND
+
+const size_t X17_ROUNDS = sizeof(rounds) / sizeof(rounds[0]);
+
+#if defined(X17_AESNI)
+/** Echo's counter-keyed AES rounds, four ShiftRows/MixColumns steps on 128-bit words. */
+#define X17_AESNI_INLINE inline __attribute__((always_inline, target("aes,sse2")))
+
+X17_AESNI_INLINE __m128i EchoXTime(__m128i x)
+{
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(_mm_cmplt_epi8(x, zero), _mm_set1_epi8(0x1b)));
+}
+
+X17_AESNI_INLINE void EchoMixColumn(__m128i* W, int ia, int ib, int ic, int id)
+{
+    __m128i a = W[ia], b = W[ib], c = W[ic], d = W[id];
+    __m128i ab = _mm_xor_si128(a, b), bc = _mm_xor_si128(b, c), cd = _mm_xor_si128(c, d);
+    __m128i abx = EchoXTime(ab), bcx = EchoXTime(bc), cdx = EchoXTime(cd);
+    W[ia] = _mm_xor_si128(abx, _mm_xor_si128(bc, d));
+    W[ib] = _mm_xor_si128(bcx, _mm_xor_si128(a, cd));
+    W[ic] = _mm_xor_si128(cdx, _mm_xor_si128(ab, d));
+    W[id] = _mm_xor_si128(_mm_xor_si128(abx, bcx), _mm_xor_si128(cdx, _mm_xor_si128(ab, c)));
+}
+
+/**
+ * echo512 of a single 64-byte message with AES-NI. The message, its padding
+ * and the bit counter all fit in the one 128-byte block, so the whole hash is
+ * a single compression of constants and the message. Matches sph_echo512.
+ */
+__attribute__((target("aes,sse2"))) void Echo512AESNI(unsigned char* out, const unsigned char* in)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i iv = _mm_set_epi32(0, 0, 0, 512);
+    __m128i W[16], M[4];
+
+    for (int i = 0; i < 8; i++)
+        W[i] = iv;
+    for (int i = 0; i < 4; i++)
+        W[8 + i] = M[i] = _mm_loadu_si128((const __m128i*)(in + 16 * i));
+    W[12] = _mm_set_epi32(0, 0, 0, 0x80);
+    W[13] = zero;
+    W[14] = _mm_set_epi16(512, 0, 0, 0, 0, 0, 0, 0);
+    W[15] = _mm_set_epi32(0, 0, 0, 512);
+
+    // The key is the message bit counter, incremented per word; 512 + 160 never carries.
+    uint32_t k = 512;
+    for (int r = 0; r < 10; r++) {
+        for (int n = 0; n < 16; n++)
+            W[n] = _mm_aesenc_si128(_mm_aesenc_si128(W[n], _mm_cvtsi32_si128(k++)), zero);
+
+        __m128i t = W[1];
+        W[1] = W[5];
+        W[5] = W[9];
+        W[9] = W[13];
+        W[13] = t;
+        t = W[2];
+        W[2] = W[10];
+        W[10] = t;
+        t = W[6];
+        W[6] = W[14];
+        W[14] = t;
+        t = W[15];
+        W[15] = W[11];
+        W[11] = W[7];
+        W[7] = W[3];
+        W[3] = t;
+
+        EchoMixColumn(W, 0, 1, 2, 3);
+        EchoMixColumn(W, 4, 5, 6, 7);
+        EchoMixColumn(W, 8, 9, 10, 11);
+        EchoMixColumn(W, 12, 13, 14, 15);
+    }
+
+    for (int i = 0; i < 4; i++)
+        _mm_storeu_si128((__m128i*)(out + 16 * i), _mm_xor_si128(_mm_xor_si128(iv, M[i]), _mm_xor_si128(W[i], W[i + 8])));
+}
+
+#undef X17_AESNI_INLINE
+
+/** Index of echo512 in rounds[]. */
+const size_t X17_ECHO_ROUND = 10;
+#endif
+
+/** Number of messages pushed through a round before moving on to the next one. */
+const size_t X17_GROUP = 8;
+
+/**
+ * Freshly initialized contexts, set up once and copied instead of calling _init
+ * per hash, and the hardware implementations picked for this CPU. A round with
+ * a non-null hash64 hashes its 64-byte input with it instead of the sph code.
+ */
+struct X17InitialContexts {
+    X17Context ctx[X17_ROUNDS];
+    void (*hash64[X17_ROUNDS])(unsigned char* out, const unsigned char* in);
+
+    X17InitialContexts()
+    {
+        for (size_t i = 0; i < X17_ROUNDS; i++) {
+            rounds[i].init(&ctx[i]);
+            hash64[i] = NULL;
+        }
+#if defined(X17_AESNI)
+        if (__builtin_cpu_supports("aes"))
+            hash64[X17_ECHO_ROUND] = Echo512AESNI;
+#endif
+    }
+};
+
+const X17InitialContexts& GetInitialContexts()
+{
+    static const X17InitialContexts initial;
+    return initial;
+}
+
+/** Hash up to X17_GROUP messages, one round at a time. */
+void HashGroup(unsigned char* out, const unsigned char* in, size_t nLen, size_t nItems)
+{
+    static const unsigned char pblank[1] = {0};
+    const X17InitialContexts& initial = GetInitialContexts();
+    X17Context ctx;
+    unsigned char buf[2][X17_GROUP][64];
+
+    // Round n reads buf[(n - 1) & 1] and writes buf[n & 1]; the first one reads the messages.
+    for (size_t j = 0; j < nItems; j++) {
+        memcpy(&ctx, &initial.ctx[0], rounds[0].nContextSize);
+        rounds[0].write(&ctx, nLen ? in + j * nLen : pblank, nLen);
+        rounds[0].close(&ctx, buf[0][j]);
+    }
+    for (size_t i = 1; i < X17_ROUNDS; i++) {
+        const X17Round& round = rounds[i];
+        if (initial.hash64[i]) {
+            for (size_t j = 0; j < nItems; j++)
+                initial.hash64[i](buf[i & 1][j], buf[(i - 1) & 1][j]);
+            continue;
+        }
+        for (size_t j = 0; j < nItems; j++) {
+            memcpy(&ctx, &initial.ctx[i], round.nContextSize);
+            round.write(&ctx, buf[(i - 1) & 1][j], 64);
+            round.close(&ctx, buf[i & 1][j]);
+        }
+    }
+
+    // The last round (haval256) only produces 32 bytes.
+    for (size_t j = 0; j < nItems; j++)
+        memcpy(out + j * X17_OUTPUT_SIZE, buf[(X17_ROUNDS - 1) & 1][j], X17_OUTPUT_SIZE);
+}
+} // namespace
+
+void X17Hash(unsigned char* out, const unsigned char* in, size_t nLen)
+{
+    HashGroup(out, in, nLen, 1);
+}
+
+void X17HashMany(unsigned char* out, const unsigned char* in, size_t nLen, size_t nItems)
+{
+    while (nItems > 0) {
+        size_t nGroup = nItems < X17_GROUP ? nItems : X17_GROUP;
+        HashGroup(out, in, nLen, nGroup);
+        out += nGroup * X17_OUTPUT_SIZE;
+        in += nGroup * nLen;
+        nItems -= nGroup;
+    }
+}
@@ -0,0 +1,24 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_X17_H
+#define BITCOIN_CRYPTO_X17_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+static const size_t X17_OUTPUT_SIZE = 32;
+
+/** Compute the X17 hash of nLen bytes at in[] into out[X17_OUTPUT_SIZE]. */
+void X17Hash(unsigned char* out, const unsigned char* in, size_t nLen);
+
+/**
+ * Compute the X17 hash of nItems messages of nLen bytes each, stored back to
+ * back in in[]. The 32-byte results are written back to back into out[].
+ * Messages are run through the chain a group at a time, one algorithm after
+ * the other, so the lookup tables of each round stay in cache for the group.
+ */
+void X17HashMany(unsigned char* out, const unsigned char* in, size_t nLen, size_t nItems);
+
+#endif // BITCOIN_CRYPTO_X17_H
@@ -5,10 +5,14 @@
 
 #include <boost/assign/list_of.hpp>
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "db.h"
 #include "kernel.h"
 #include "script/interpreter.h"
+#include "script/sigcache.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "util.h"
 #include "stakeinput.h"
 
@@ -239,18 +243,41 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
     return true;
 }
 
+// Blocks whose pindexKernelModifier changed since the last flush
+static std::set<CBlockIndex*> setDirtyStakeModifierIndex;
+
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
 bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
+    AssertLockHeld(cs_main);
     nStakeModifier = 0;
-    if (!mapBlockIndex.count(hashBlockFrom))
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlockFrom);
+    if (mi == mapBlockIndex.end())
         return error("GetKernelStakeModifier() : block not indexed");
-    const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
+    CBlockIndex* pindexFrom = mi->second;
+
+    // The result only depends on the blocks between pindexFrom and the block providing
+    // the modifier, so a memoized link holds as long as both are in the active chain
+    const bool fInActiveChain = chainActive.Contains(pindexFrom);
+    CBlockIndex* pindexModifier = pindexFrom->pindexKernelModifier;
+    if (fInActiveChain && pindexModifier && chainActive.Contains(pindexModifier)) {
+        nStakeModifierHeight = pindexModifier->nHeight;
+        nStakeModifierTime = pindexModifier->GetBlockTime();
+        nStakeModifier = pindexModifier->nStakeModifier;
+        return true;
+    }
+
+    // A link that left the active chain is replaced below, or dropped if pindexFrom left it
+    if (pindexModifier && !fInActiveChain) {
+        pindexFrom->pindexKernelModifier = NULL;
+        setDirtyStakeModifierIndex.insert(pindexFrom);
+    }
+
     nStakeModifierHeight = pindexFrom->nHeight;
     nStakeModifierTime = pindexFrom->GetBlockTime();
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
-    const CBlockIndex* pindex = pindexFrom;
+    CBlockIndex* pindex = pindexFrom;
     CBlockIndex* pindexNext = chainActive[pindexFrom->nHeight + 1];
 
     // loop to find the stake modifier later by a selection interval
@@ -269,17 +296,90 @@ bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int
         }
     }
     nStakeModifier = pindex->nStakeModifier;
+
+    // the loop always ends on the block that generated the modifier
+    if (fInActiveChain) {
+        pindexFrom->pindexKernelModifier = pindex;
+        setDirtyStakeModifierIndex.insert(pindexFrom);
+    }
     return true;
 }
 
-//test hash vs target
-bool stakeTargetHit(const uint256& hashProofOfStake, const int64_t& nValueIn, const uint256& bnTargetPerCoinDay)
+bool HaveKernelStakeModifier(const CBlockIndex* pindexFrom)
+{
+    AssertLockHeld(cs_main);
+    // GetKernelStakeModifier needs a block after pindexFrom that generated a modifier
+    // a selection interval later; look for it from the tip down
+    const int64_t nTimeNeeded = pindexFrom->GetBlockTime() + GetStakeModifierSelectionInterval();
+    for (const CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->nHeight > pindexFrom->nHeight; pindex = pindex->pprev) {
+        if (pindex->GeneratedStakeModifier() && pindex->GetBlockTime() >= nTimeNeeded)
+            return true;
+    }
+    return false;
+}
+
+bool FlushStakeModifierIndex()
+{
+    AssertLockHeld(cs_main);
+    if (setDirtyStakeModifierIndex.empty())
+        return true;
+
+    std::vector<std::pair<uint256, uint256> > vIndex;
+    vIndex.reserve(setDirtyStakeModifierIndex.size());
+    BOOST_FOREACH (const CBlockIndex* pindex, setDirtyStakeModifierIndex) {
+        // A null link erases the entry
+        uint256 hashModifier = pindex->pindexKernelModifier ? pindex->pindexKernelModifier->GetBlockHash() : uint256(0);
+        vIndex.push_back(make_pair(pindex->GetBlockHash(), hashModifier));
+    }
+    if (!pblocktree->WriteStakeModifierIndex(vIndex))
+        return false;
+    setDirtyStakeModifierIndex.clear();
+    return true;
+}
+
+//get the kernel hash target for an input of the given value
+static uint256 GetStakeTarget(const int64_t& nValueIn, const uint256& bnTargetPerCoinDay)
 {
     //get the stake weight - weight is equal to coin amount
     uint256 bnCoinDayWeight = uint256(nValueIn) / 100 / 50;
+    return bnCoinDayWeight * bnTargetPerCoinDay;
+}
 
+//test hash vs target
+bool stakeTargetHit(const uint256& hashProofOfStake, const int64_t& nValueIn, const uint256& bnTargetPerCoinDay)
+{
     // Now check if proof-of-stake hash meets target protocol
-    return hashProofOfStake < (bnCoinDayWeight * bnTargetPerCoinDay);
+    return hashProofOfStake < GetStakeTarget(nValueIn, bnTargetPerCoinDay);
+}
+
+// Compute the kernel hashes of a whole window of timestamps at once.
+// The serialized kernel only differs in its trailing nTimeTx, so the fixed
+// part is serialized once and the hashes are run through the multi-lane SHA256d.
+static void GetKernelHashes(const CDataStream& ssKernelPrefix, const vector<unsigned int>& vTimeTx, vector<uint256>& vHashes)
+{
+    const size_t nPrefixLen = ssKernelPrefix.size();
+    const size_t nLen = nPrefixLen + sizeof(unsigned int);
+    vHashes.resize(vTimeTx.size());
+    if (vTimeTx.empty())
+        return;
+
+    if (nLen > 55) {
+        // Does not fit in a single SHA256 block, hash one by one
+        for (unsigned int i = 0; i < vTimeTx.size(); i++) {
+            CDataStream ss(ssKernelPrefix);
+            ss << vTimeTx[i];
+            vHashes[i] = Hash(ss.begin(), ss.end());
+        }
+        return;
+    }
+
+    vector<unsigned char> vKernels(nLen * vTimeTx.size());
+    for (unsigned int i = 0; i < vTimeTx.size(); i++) {
+        unsigned char* pch = &vKernels[i * nLen];
+        memcpy(pch, &ssKernelPrefix[0], nPrefixLen);
+        WriteLE32(pch + nPrefixLen, vTimeTx[i]);
+    }
+    SHA256DOneBlock(vHashes[0].begin(), &vKernels[0], nLen, vTimeTx.size());
 }
 
 bool CheckStake(const CDataStream& ssUniqueID, CAmount nValueIn, const uint64_t nStakeModifier, const uint256& bnTarget,
@@ -312,27 +412,37 @@ bool Stake(CStakeInput* stakeInput, unsigned int nBits, unsigned int nTimeBlockF
         return error("failed to get kernel stake modifier");
 
     bool fSuccess = false;
-    unsigned int nTryTime = 0;
     int nHeightStart = chainActive.Height();
     int nHashDrift = 300;
-    CDataStream ssUniqueID = stakeInput->GetUniqueness();
     CAmount nValueIn = stakeInput->GetValue();
-    for (int i = 0; i < nHashDrift; i++) //iterate the hashing
+    uint256 bnTarget = GetStakeTarget(nValueIn, bnTargetPerCoinDay);
+
+    // Same serialization as CheckStake(), minus the trailing nTimeTx
+    CDataStream ssKernelPrefix(SER_GETHASH, 0);
+    ssKernelPrefix << nStakeModifier << nTimeBlockFrom << stakeInput->GetUniqueness();
+
+    vector<unsigned int> vTryTime(nHashDrift);
+    for (int i = 0; i < nHashDrift; i++)
+        vTryTime[i] = nTimeTx + (nHashDrift/2) - i;
+
+    //hash the whole window at once
+    vector<uint256> vHashes;
+    GetKernelHashes(ssKernelPrefix, vTryTime, vHashes);
+
+    for (int i = 0; i < nHashDrift; i++) //iterate the hashes
     {
         //new block came in, move on
         if (chainActive.Height() != nHeightStart)
             break;
 
-        //hash this iteration
-        nTryTime = nTimeTx + (nHashDrift/2) - i;
-
         // if stake hash does not meet the target then continue to next iteration
-        if (!CheckStake(ssUniqueID, nValueIn, nStakeModifier, bnTargetPerCoinDay, nTimeBlockFrom, nTryTime, hashProofOfStake))
+        if (!(vHashes[i] < bnTarget))
             continue;
 
         fSuccess = true; // if we make it this far then we have successfully created a stake hash
+        hashProofOfStake = vHashes[i];
         //LogPrintf("%s: hashproof=%s\n", __func__, hashProofOfStake.GetHex());
-        nTimeTx = nTryTime;
+        nTimeTx = vTryTime[i];
         break;
     }
 
@@ -358,8 +468,9 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake, std::uniqu
     if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true))
        return error("CheckProofOfStake() : INFO: read txPrev failed");
 
-        //verify signature and script
-    if (!VerifyScript(txin.scriptSig, txPrev.vout[txin.prevout.n].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0)))
+    // Verify signature and script. The result goes into the signature cache, so a coinstake that
+    // was pre-verified in a batch (see PreverifyCoinStakes) and ConnectBlock's check are cache hits.
+    if (!VerifyScript(txin.scriptSig, txPrev.vout[txin.prevout.n].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, CachingTransactionSignatureChecker(&tx, 0)))
         return error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx.GetHash().ToString().c_str());
 
     CPivStake* pivInput = new CPivStake();
@@ -370,11 +481,6 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake, std::uniqu
     if (!pindex)
         return error("%s: Failed to find the block index", __func__);
 
-    // Read block header
-    CBlock blockprev;
-    if (!ReadBlockFromDisk(blockprev, pindex->GetBlockPos()))
-        return error("CheckProofOfStake(): INFO: failed to find block");
-
     uint256 bnTargetPerCoinDay;
     bnTargetPerCoinDay.SetCompact(block.nBits);
 
@@ -382,7 +488,8 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake, std::uniqu
     if (!stake->GetModifier(nStakeModifier))
         return error("%s failed to get modifier for stake input\n", __func__);
 
-    unsigned int nBlockFromTime = blockprev.nTime;
+    // The index carries the header time, no need to read the block from disk
+    unsigned int nBlockFromTime = pindex->nTime;
     unsigned int nTxTime = block.nTime;
     if (!CheckStake(stake->GetUniqueness(), stake->GetValue(), nStakeModifier, bnTargetPerCoinDay, nBlockFromTime,
                     nTxTime, hashProofOfStake)) {
@@ -21,6 +21,10 @@ static const int MODIFIER_INTERVAL_RATIO = 3;
 
 // Compute the hash modifier for proof-of-stake
 bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake);
+// Whether the active chain has the block GetKernelStakeModifier picks for coins from pindexFrom yet
+bool HaveKernelStakeModifier(const CBlockIndex* pindexFrom);
+// Write the kernel stake modifier links memoized by GetKernelStakeModifier to the block tree db
+bool FlushStakeModifierIndex();
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 
 bool CheckStake(const CDataStream& ssUniqueID, CAmount nValueIn, const uint64_t nStakeModifier, const uint256& bnTarget, unsigned int nTimeBlockFrom, unsigned int& nTimeTx, uint256& hashProofOfStake);
@@ -10,6 +10,7 @@
 
 #include "addrman.h"
 #include "alert.h"
+#include "blockprefetch.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -35,6 +36,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace boost;
@@ -63,9 +65,12 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = true;
+bool fAddressIndex = DEFAULT_ADDRESSINDEX;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+bool fCheckBlockReads = DEFAULT_CHECKBLOCKREADS;
+size_t nCoinCacheUsage = 5000 * 300;
+bool fPartialFlush = DEFAULT_PARTIALFLUSH;
 bool fAlerts = DEFAULT_ALERTS;
 
 unsigned int nStakeMinAge = 30 * 60;
@@ -170,6 +175,9 @@ int nPreferredDownload = 0;
 /** Dirty block index entries. */
 set<CBlockIndex*> setDirtyBlockIndex;
 
+/** Blocks whose verified PoW hash is not in the block tree db yet. */
+set<CBlockIndex*> setDirtyPoWHash;
+
 /** Dirty block file entries. */
 set<int> setDirtyFileInfo;
 } // anon namespace
@@ -364,6 +372,8 @@ struct CNodeState {
     bool fPreferredDownload;
 
     CNodeBlocks nodeBlocks;
+    //! Blocks of the "block" messages queued next from this peer, read ahead by PreverifyQueuedBlocks.
+    std::deque<CBlock> queuePreverifiedBlocks;
 
     CNodeState()
     {
@@ -1156,13 +1166,26 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
             nMinFee = 0;
     }
 
+    // A full mempool only takes transactions paying more than what it evicted
+    CAmount nMemPoolMinFee = mempool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nBytes);
+    nMinFee = std::max(nMinFee, nMemPoolMinFee);
+
     if (!MoneyRange(nMinFee))
         nMinFee = Params().MaxMoneyOut();
     return nMinFee;
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
+
+static bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee = false, bool ignoreFees = false)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1276,9 +1299,10 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
         CAmount nValueOut = tx.GetValueOut();
         CAmount nFees = nValueIn - nValueOut;
-        double dPriority = view.GetPriority(tx, chainActive.Height());
+        CAmount inChainInputValue;
+        double dPriority = view.GetPriority(tx, chainActive.Height(), inChainInputValue);
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), inChainInputValue);
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1328,7 +1352,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true)) {
+        if (!CheckInputsParallel(tx, state, view, STANDARD_SCRIPT_VERIFY_FLAGS, true)) {
             return error("AcceptToMemoryPool: : ConnectInputs failed %s", hash.ToString());
         }
 
@@ -1347,6 +1371,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry);
+
+        // Make room for it, which may evict it again if it pays the least
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -1354,6 +1383,149 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
     return true;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fRejectInsaneFee, ignoreFees);
+}
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+//! Transactions from mempool.dat whose scripts are checked together before they are accepted
+static const unsigned int MEMPOOL_LOAD_BATCH_SIZE = 256;
+
+static void PreverifyMempoolScripts(std::vector<std::pair<CTransaction, int64_t> >::const_iterator itBegin, std::vector<std::pair<CTransaction, int64_t> >::const_iterator itEnd);
+
+//! Append hash to vOrdered after the pool transactions it spends
+static void AddMempoolDependencyOrdered(const uint256& hash, std::set<uint256>& setDone, std::vector<uint256>& vOrdered)
+{
+    AssertLockHeld(mempool.cs);
+    if (!setDone.insert(hash).second)
+        return;
+    const CTxMemPoolEntry& entry = mempool.mapTx.find(hash)->second;
+    BOOST_FOREACH (const uint256& hashParent, entry.GetMemPoolParents())
+        AddMempoolDependencyOrdered(hashParent, setDone, vOrdered);
+    vOrdered.push_back(hash);
+}
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    std::vector<std::pair<CTransaction, int64_t> > vTx;
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    {
+        LOCK(mempool.cs);
+        // Oldest first, but always after the transactions they spend, so they
+        // can be accepted again in the order they are read
+        std::set<uint256> setDone;
+        std::vector<uint256> vOrdered;
+        vOrdered.reserve(mempool.mapTx.size());
+        BOOST_FOREACH (const PAIRTYPE(int64_t, uint256) & item, mempool.GetTimeIndex())
+            AddMempoolDependencyOrdered(item.second, setDone, vOrdered);
+        vTx.reserve(vOrdered.size());
+        BOOST_FOREACH (const uint256& hash, vOrdered) {
+            const CTxMemPoolEntry& entry = mempool.mapTx.find(hash)->second;
+            vTx.push_back(std::make_pair(entry.GetTx(), entry.GetTime()));
+        }
+        mapDeltas = mempool.mapDeltas;
+    }
+
+    int64_t nMid = GetTimeMicros();
+
+    try {
+        boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+        CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull())
+            return error("%s : failed to open %s", __func__, pathTmp.string());
+
+        fileout << MEMPOOL_DUMP_VERSION;
+        fileout << (uint64_t)vTx.size();
+        for (std::vector<std::pair<CTransaction, int64_t> >::const_iterator it = vTx.begin(); it != vTx.end(); ++it) {
+            fileout << it->first;
+            fileout << it->second;
+        }
+        // The deltas of transactions that are not in the pool are kept too
+        fileout << mapDeltas;
+        FileCommit(fileout.Get());
+        fileout.fclose();
+        if (!RenameOver(pathTmp, GetDataDir() / "mempool.dat"))
+            return error("%s : rename into place failed", __func__);
+    } catch (const std::exception& e) {
+        return error("%s : failed to dump mempool: %s", __func__, e.what());
+    }
+
+    LogPrintf("Dumped mempool: %u transactions, %.3fs to copy, %.3fs to write\n", vTx.size(), (nMid - nStart) * 0.000001, (GetTimeMicros() - nMid) * 0.000001);
+    return true;
+}
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    boost::filesystem::path path = GetDataDir() / "mempool.dat";
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMicros();
+    int64_t nNow = GetTime();
+    int nAccepted = 0, nFailed = 0, nExpired = 0;
+    try {
+        uint64_t nVersion;
+        filein >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return error("%s : unknown mempool file version %u", __func__, nVersion);
+
+        // Read everything first, so a truncated file adds nothing
+        uint64_t nCount;
+        filein >> nCount;
+        std::vector<std::pair<CTransaction, int64_t> > vTx;
+        for (uint64_t i = 0; i < nCount; i++) {
+            CTransaction tx;
+            int64_t nTime;
+            filein >> tx;
+            filein >> nTime;
+            if (nTime + nExpiryTimeout <= nNow)
+                nExpired++;
+            else
+                vTx.push_back(std::make_pair(tx, nTime));
+        }
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        filein >> mapDeltas;
+
+        // Deltas go in first, so the entries pick them up as they are added
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+        for (size_t i = 0; i < vTx.size(); i++) {
+            // The scripts of the next batch are verified together on the script
+            // threads, so accepting its transactions one by one hits the sigcache
+            std::vector<std::pair<CTransaction, int64_t> >::const_iterator it = vTx.begin() + i;
+            if (i % MEMPOOL_LOAD_BATCH_SIZE == 0)
+                PreverifyMempoolScripts(it, vTx.begin() + std::min(i + MEMPOOL_LOAD_BATCH_SIZE, vTx.size()));
+            // cs_main is taken per transaction, so blocks and peers don't wait
+            // for the whole file
+            CValidationState state;
+            bool fAccepted;
+            {
+                LOCK(cs_main);
+                fAccepted = AcceptToMemoryPoolWithTime(mempool, state, it->first, true, NULL, it->second);
+            }
+            if (fAccepted)
+                nAccepted++;
+            else
+                nFailed++;
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        return error("%s : failed to read mempool data on disk: %s. Continuing anyway.", __func__, e.what());
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired in %.3fs\n", nAccepted, nFailed, nExpired, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool isDSTX)
 {
     AssertLockHeld(cs_main);
@@ -1465,9 +1637,10 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
 
         CAmount nValueOut = tx.GetValueOut();
         CAmount nFees = nValueIn - nValueOut;
-        double dPriority = view.GetPriority(tx, chainActive.Height());
+        CAmount inChainInputValue;
+        double dPriority = view.GetPriority(tx, chainActive.Height(), inChainInputValue);
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), inChainInputValue);
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1545,50 +1718,72 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
     return true;
 }
 
-/** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
+struct CompareTxPos {
+    bool operator()(const std::pair<CDiskTxPos, size_t>& a, const std::pair<CDiskTxPos, size_t>& b) const
+    {
+        if (a.first.nFile != b.first.nFile)
+            return a.first.nFile < b.first.nFile;
+        if (a.first.nPos != b.first.nPos)
+            return a.first.nPos < b.first.nPos;
+        return a.first.nTxOffset < b.first.nTxOffset;
+    }
+};
+
+/** Read the transaction at postx from an open block file */
+static bool ReadTxFromFile(CAutoFile& file, const CDiskTxPos& postx, CTransaction& txOut, uint256& hashBlock)
+{
+    CBlockHeader header;
+    try {
+        if (fseek(file.Get(), postx.nPos, SEEK_SET))
+            return error("%s : fseek failed", __func__);
+        file >> header;
+        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+        file >> txOut;
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    hashBlock = header.GetHash();
+    return true;
+}
+
+/** Block on the active chain holding the unspent outputs of hash, found through the coins cache */
+static CBlockIndex* FindSlowTxBlock(const uint256& hash)
+{
+    AssertLockHeld(cs_main);
+    const CCoins* coins = pcoinsTip->AccessCoins(hash);
+    if (coins && coins->nHeight > 0)
+        return chainActive[coins->nHeight];
+    return NULL;
+}
+
+/**
+ * Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock.
+ * cs_main is only held to find the block of a transaction without -txindex; the
+ * mempool and the txindex have their own locking and all disk reads happen outside it.
+ */
 bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock, bool fAllowSlow)
 {
-    CBlockIndex* pindexSlow = NULL;
-    {
-        LOCK(cs_main);
-        {
-            if (mempool.lookup(hash, txOut)) {
-                return true;
-            }
-        }
+    if (mempool.lookup(hash, txOut))
+        return true;
 
-        if (fTxIndex) {
-            CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (std::exception& e) {
-                    return error("%s : Deserialize or I/O error - %s", __func__, e.what());
-                }
-                hashBlock = header.GetHash();
-                if (txOut.GetHash() != hash)
-                    return error("%s : txid mismatch", __func__);
-                return true;
-            }
+    if (fTxIndex) {
+        CDiskTxPos postx;
+        if (pblocktree->ReadTxIndex(hash, postx)) {
+            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+            if (file.IsNull())
+                return error("%s: OpenBlockFile failed", __func__);
+            if (!ReadTxFromFile(file, postx, txOut, hashBlock))
+                return false;
+            if (txOut.GetHash() != hash)
+                return error("%s : txid mismatch", __func__);
+            return true;
         }
+    }
 
-        if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
-            int nHeight = -1;
-            {
-                CCoinsViewCache& view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
-            }
-            if (nHeight > 0)
-                pindexSlow = chainActive[nHeight];
-        }
+    CBlockIndex* pindexSlow = NULL;
+    if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
+        LOCK(cs_main);
+        pindexSlow = FindSlowTxBlock(hash);
     }
 
     if (pindexSlow) {
@@ -1607,6 +1802,117 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
     return false;
 }
 
+unsigned int GetTransactions(const std::vector<uint256>& vHashes, std::vector<CTransaction>& vTxOut, std::vector<uint256>& vHashBlock, bool fAllowSlow)
+{
+    vTxOut.assign(vHashes.size(), CTransaction());
+    vHashBlock.assign(vHashes.size(), uint256());
+    unsigned int nFound = 0;
+
+    // Resolve positions first, then read them in file order
+    std::vector<std::pair<CDiskTxPos, size_t> > vPos;
+    std::vector<size_t> vMissing;
+    for (size_t i = 0; i < vHashes.size(); i++) {
+        if (mempool.lookup(vHashes[i], vTxOut[i])) {
+            nFound++;
+            continue;
+        }
+        CDiskTxPos postx;
+        if (fTxIndex && pblocktree->ReadTxIndex(vHashes[i], postx))
+            vPos.push_back(std::make_pair(postx, i));
+        else
+            vMissing.push_back(i);
+    }
+    std::sort(vPos.begin(), vPos.end(), CompareTxPos());
+
+    for (size_t i = 0; i < vPos.size();) {
+        const int nFile = vPos[i].first.nFile;
+        CAutoFile file(OpenBlockFile(vPos[i].first, true), SER_DISK, CLIENT_VERSION);
+        for (; i < vPos.size() && vPos[i].first.nFile == nFile; i++) {
+            const size_t n = vPos[i].second;
+            if (file.IsNull() || !ReadTxFromFile(file, vPos[i].first, vTxOut[n], vHashBlock[n]) || vTxOut[n].GetHash() != vHashes[n]) {
+                vTxOut[n] = CTransaction();
+                vHashBlock[n] = uint256();
+                vMissing.push_back(n);
+                continue;
+            }
+            nFound++;
+        }
+    }
+
+    if (!fAllowSlow || vMissing.empty())
+        return nFound;
+
+    // Without (a usable) txindex: read each block holding some of the rest once, in chain order
+    std::map<int, std::pair<CBlockIndex*, std::vector<size_t> > > mapBlocks;
+    {
+        LOCK(cs_main);
+        BOOST_FOREACH (size_t n, vMissing) {
+            CBlockIndex* pindexSlow = FindSlowTxBlock(vHashes[n]);
+            if (pindexSlow) {
+                mapBlocks[pindexSlow->nHeight].first = pindexSlow;
+                mapBlocks[pindexSlow->nHeight].second.push_back(n);
+            }
+        }
+    }
+    for (std::map<int, std::pair<CBlockIndex*, std::vector<size_t> > >::const_iterator it = mapBlocks.begin(); it != mapBlocks.end(); ++it) {
+        CBlockIndex* pindexSlow = it->second.first;
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindexSlow))
+            continue;
+        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+            BOOST_FOREACH (size_t n, it->second.second) {
+                if (tx.GetHash() == vHashes[n]) {
+                    vTxOut[n] = tx;
+                    vHashBlock[n] = pindexSlow->GetBlockHash();
+                    nFound++;
+                }
+            }
+        }
+    }
+    return nFound;
+}
+
+int GetAddressIndexType(const CScript& scriptPubKey, uint160& hashBytes)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(scriptPubKey, dest))
+        return ADDRESS_INDEX_NONE;
+    if (const CKeyID* keyID = boost::get<CKeyID>(&dest)) {
+        hashBytes = *keyID;
+        return ADDRESS_INDEX_KEY;
+    }
+    if (const CScriptID* scriptID = boost::get<CScriptID>(&dest)) {
+        hashBytes = *scriptID;
+        return ADDRESS_INDEX_SCRIPT;
+    }
+    return ADDRESS_INDEX_NONE;
+}
+
+bool GetAddressIndex(const uint160& hashBytes, int type, std::vector<std::pair<CAddressIndexKey, CAmount> >& vAddressIndex, int nStart, int nEnd)
+{
+    if (!fAddressIndex)
+        return error("%s : address index not enabled", __func__);
+    if (!pblocktree->ReadAddressIndex(hashBytes, type, vAddressIndex, nStart, nEnd))
+        return error("%s : unable to read address index", __func__);
+    return true;
+}
+
+bool GetAddressUnspent(const uint160& hashBytes, int type, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent)
+{
+    if (!fAddressIndex)
+        return error("%s : address index not enabled", __func__);
+    if (!pblocktree->ReadAddressUnspentIndex(hashBytes, type, vUnspent))
+        return error("%s : unable to read address unspent index", __func__);
+    return true;
+}
+
+bool GetSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value)
+{
+    if (!fAddressIndex)
+        return false;
+    return pblocktree->ReadSpentIndex(key, value);
+}
+
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -1634,40 +1940,210 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+namespace {
+/**
+ * Read-only handles of the block and undo files read most recently, so serving
+ * old blocks doesn't reopen the file for every read. A record is read with two
+ * positioned reads: the size stored in front of it, then the record itself.
+ *
+ * Reads don't go through a stdio buffer, which could hold bytes of a file from
+ * before they were written; the handles of the file being written are also
+ * dropped on every flush of it. The lock only covers finding the handle, so
+ * reads from different threads run side by side.
+ */
+class CDiskFileReadCache
+{
+private:
+    static const size_t MAX_OPEN_FILES = 16;
+
+    struct CEntry {
+        FILE* file;
+        uint64_t nLastUse;
+        //! Serializes the seek and read where there is no pread
+        CCriticalSection csFile;
+
+        CEntry(FILE* fileIn) : file(fileIn), nLastUse(0) {}
+        ~CEntry() { fclose(file); }
+    };
+    typedef boost::shared_ptr<CEntry> entry_ptr;
+    //! keyed by (first letter of the file prefix, file number)
+    typedef std::map<std::pair<char, int>, entry_ptr> file_map;
+    file_map mapFiles;
+    uint64_t nUseCounter;
+    CCriticalSection cs;
+
+    entry_ptr Get(const CDiskBlockPos& pos, const char* prefix)
+    {
+        LOCK(cs);
+        std::pair<char, int> key(prefix[0], pos.nFile);
+        file_map::iterator it = mapFiles.find(key);
+        if (it == mapFiles.end()) {
+            FILE* file = fopen(GetBlockPosFilename(pos, prefix).string().c_str(), "rb");
+            if (!file)
+                return entry_ptr();
+            setvbuf(file, NULL, _IONBF, 0);
+            if (mapFiles.size() >= MAX_OPEN_FILES) {
+                file_map::iterator itOldest = mapFiles.begin();
+                for (file_map::iterator itEntry = mapFiles.begin(); itEntry != mapFiles.end(); ++itEntry)
+                    if (itEntry->second->nLastUse < itOldest->second->nLastUse)
+                        itOldest = itEntry;
+                // A read still using it keeps the handle open until it is done
+                mapFiles.erase(itOldest);
+            }
+            it = mapFiles.insert(std::make_pair(key, entry_ptr(new CEntry(file)))).first;
+        }
+        it->second->nLastUse = ++nUseCounter;
+        return it->second;
+    }
+
+    static bool ReadAt(CEntry& entry, unsigned char* buf, size_t nSize, unsigned int nPos)
+    {
+#ifdef WIN32
+        LOCK(entry.csFile);
+        return fseek(entry.file, nPos, SEEK_SET) == 0 && fread(buf, 1, nSize, entry.file) == nSize;
+#else
+        int fd = fileno(entry.file);
+        while (nSize > 0) {
+            ssize_t nRead = pread(fd, buf, nSize, nPos);
+            if (nRead < 0 && errno == EINTR)
+                continue;
+            if (nRead <= 0)
+                return false;
+            buf += nRead;
+            nSize -= nRead;
+            nPos += nRead;
+        }
+        return true;
+#endif
+    }
+
+public:
+    CDiskFileReadCache() : nUseCounter(0) {}
+
+    /**
+     * Read the record written at pos, plus nExtra trailing bytes, into ssRet.
+     * Returns false if the file or the message start/size header in front of
+     * pos can't be read, in which case the caller falls back to streaming.
+     */
+    bool Read(const CDiskBlockPos& pos, const char* prefix, unsigned int nExtra, CDataStream& ssRet)
+    {
+        if (pos.IsNull() || pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+            return false;
+
+        entry_ptr entry = Get(pos, prefix);
+        if (!entry)
+            return false;
+        unsigned char header[MESSAGE_START_SIZE + sizeof(unsigned int)];
+        if (!ReadAt(*entry, header, sizeof(header), pos.nPos - sizeof(header)))
+            return false;
+        if (memcmp(header, Params().MessageStart(), MESSAGE_START_SIZE))
+            return false;
+        unsigned int nSize = ReadLE32(header + MESSAGE_START_SIZE);
+        if (nSize > MAX_SIZE)
+            return false;
+        ssRet.resize(nSize + nExtra);
+        if (!ReadAt(*entry, (unsigned char*)&ssRet[0], ssRet.size(), pos.nPos)) {
+            ssRet.clear();
+            return false;
+        }
+        return true;
+    }
+
+    //! Close the handles of block and undo file nFile, after it was written to
+    void Drop(int nFile)
+    {
+        LOCK(cs);
+        mapFiles.erase(std::make_pair('b', nFile));
+        mapFiles.erase(std::make_pair('r', nFile));
+    }
+};
+
+CDiskFileReadCache diskFileReadCache;
+}
+
+static bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckPoW)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
+    CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+    if (diskFileReadCache.Read(pos, "blk", 0, ssBlock)) {
+        try {
+            ssBlock >> block;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk : OpenBlockFile failed");
 
-    // Read block
-    try {
-        filein >> block;
-    } catch (std::exception& e) {
-        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        // Read block
+        try {
+            filein >> block;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Check the header
-    if (block.IsProofOfWork()) {
+    if (fCheckPoW && block.IsProofOfWork()) {
         if (!CheckProofOfWork(block.GetPoWHash(), block.nBits)) {
             	return error("ReadBlockFromDisk : Errors in block header");
 	}
     }
 
+    if (fCheckBlockReads) {
+        bool fMutated;
+        if (block.BuildMerkleTree(&fMutated) != block.hashMerkleRoot || fMutated)
+            return error("ReadBlockFromDisk : merkle root mismatch at file %d pos %u", pos.nFile, pos.nPos);
+    }
+
     return true;
 }
 
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    return ReadBlockFromDisk(block, pos, true);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), false))
         return false;
     if (block.GetHash() != pindex->GetBlockHash()) {
         LogPrintf("%s : block=%s index=%s\n", __func__, block.GetHash().ToString().c_str(), pindex->GetBlockHash().ToString().c_str());
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : GetHash() doesn't match index");
     }
+    // The header matches the index, so a PoW hash verified for it before can be
+    // checked against nBits instead of rerunning X17. The hash is published
+    // without cs_main, so the prefetch thread and GetTransaction don't take it.
+    if (block.IsProofOfWork()) {
+        uint256 hashPoW = pindex->HavePoWHash() ? pindex->hashPoW : block.GetPoWHash();
+        if (!CheckProofOfWork(hashPoW, block.nBits))
+            return error("ReadBlockFromDisk : Errors in block header");
+    }
+    return true;
+}
+
+/**
+ * Check the proof of work of a block whose header matches pindex. The verified
+ * X17 hash is kept in the block index, so every PoW header is only hashed once.
+ * hashPoWChecked is the hash CheckBlock already verified for this block, if any.
+ */
+static bool CheckBlockIndexPoW(const CBlock& block, CBlockIndex* pindex, const uint256& hashPoWChecked = uint256(0))
+{
+    AssertLockHeld(cs_main);
+    if (!block.IsProofOfWork())
+        return true;
+    if (pindex->HavePoWHash())
+        return CheckProofOfWork(pindex->hashPoW, block.nBits);
+
+    uint256 hashPoW = hashPoWChecked != 0 ? hashPoWChecked : block.GetPoWHash();
+    if (!CheckProofOfWork(hashPoW, block.nBits))
+        return false;
+    pindex->SetPoWHash(hashPoW);
+    setDirtyPoWHash.insert(pindex);
     return true;
 }
 
@@ -2054,11 +2530,29 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock() : block and undo data inconsistent");
 
+    // VerifyDB disconnects blocks (with pfClean) on a throwaway view only, leave the indexes alone then
+    bool fUpdateAddressIndex = fAddressIndex && !pfClean;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspent;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpentIndex;
+
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction& tx = block.vtx[i];
         uint256 hash = tx.GetHash();
 
+        if (fUpdateAddressIndex) {
+            for (unsigned int k = tx.vout.size(); k-- > 0;) {
+                const CTxOut& out = tx.vout[k];
+                uint160 hashBytes;
+                int type = GetAddressIndexType(out.scriptPubKey, hashBytes);
+                if (type == ADDRESS_INDEX_NONE)
+                    continue;
+                vAddressIndex.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, hash, k, false), out.nValue));
+                vAddressUnspent.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, hash, k), CAddressUnspentValue()));
+            }
+        }
+
         // Check that all outputs are available and match the outputs in the block itself
         // exactly. Note that transactions with only provably unspendable outputs won't
         // have outputs available even in the block itself, so we handle that case
@@ -2107,10 +2601,29 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                 if (coins->vout.size() < out.n + 1)
                     coins->vout.resize(out.n + 1);
                 coins->vout[out.n] = undo.txout;
+
+                if (fUpdateAddressIndex) {
+                    vSpentIndex.push_back(std::make_pair(CSpentIndexKey(out.hash, out.n), CSpentIndexValue()));
+                    uint160 hashBytes;
+                    int type = GetAddressIndexType(undo.txout.scriptPubKey, hashBytes);
+                    if (type != ADDRESS_INDEX_NONE) {
+                        vAddressIndex.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, hash, j, true), -undo.txout.nValue));
+                        vAddressUnspent.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, out.hash, out.n), CAddressUnspentValue(undo.txout.nValue, undo.txout.scriptPubKey, coins->nHeight)));
+                    }
+                }
             }
         }
     }
 
+    if (fUpdateAddressIndex) {
+        if (!pblocktree->EraseAddressIndex(vAddressIndex))
+            return state.Abort("Failed to delete address index");
+        if (!pblocktree->UpdateAddressUnspentIndex(vAddressUnspent))
+            return state.Abort("Failed to write address unspent index");
+        if (!pblocktree->UpdateSpentIndex(vSpentIndex))
+            return state.Abort("Failed to write spent index");
+    }
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -2143,6 +2656,8 @@ void static FlushBlockFile(bool fFinalize = false)
         FileCommit(fileOld);
         fclose(fileOld);
     }
+
+    diskFileReadCache.Drop(nLastBlockFile);
 }
 
 bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigned int nAddSize);
@@ -2155,6 +2670,229 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+bool CheckInputsParallel(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, unsigned int flags, bool cacheStore)
+{
+    if (!nScriptCheckThreads || tx.vin.size() < MIN_PARALLEL_SCRIPT_CHECKS)
+        return CheckInputs(tx, state, view, true, flags, cacheStore);
+
+    std::vector<CScriptCheck> vChecks;
+    if (!CheckInputs(tx, state, view, true, flags, cacheStore, &vChecks))
+        return false;
+    {
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        control.Add(vChecks);
+        if (control.Wait())
+            return true;
+    }
+    // Do it again inline, to fill state with the reason the scripts failed
+    return CheckInputs(tx, state, view, true, flags, cacheStore);
+}
+
+/**
+ * Collect the script checks of a batch of transactions read from mempool.dat and run them
+ * on the script check threads; the valid signatures land in the signature cache. Nothing is
+ * accepted here: LoadMempool still hands each transaction to AcceptToMemoryPool in order.
+ * Transactions spending others of the batch are checked against a view with those applied.
+ */
+static void PreverifyMempoolScripts(std::vector<std::pair<CTransaction, int64_t> >::const_iterator itBegin, std::vector<std::pair<CTransaction, int64_t> >::const_iterator itEnd)
+{
+    if (!nScriptCheckThreads)
+        return;
+
+    std::vector<CScriptCheck> vChecks;
+    {
+        LOCK2(cs_main, mempool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        CCoinsViewCache view(&viewMemPool);
+        int nHeight = chainActive.Height() + 1;
+        for (std::vector<std::pair<CTransaction, int64_t> >::const_iterator it = itBegin; it != itEnd; ++it) {
+            const CTransaction& tx = it->first;
+            if (tx.IsCoinBase() || tx.IsCoinStake() || mempool.exists(tx.GetHash()) || !view.HaveInputs(tx))
+                continue;
+            CValidationState state;
+            if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, &vChecks))
+                continue;
+            CTxUndo undoDummy;
+            UpdateCoins(tx, state, view, undoDummy, nHeight);
+        }
+    }
+    if (vChecks.size() < 2)
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    size_t nChecks = vChecks.size();
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    bool fValid = control.Wait();
+    LogPrint("bench", "    - Preverify %u mempool scripts: %.2fms%s\n", (unsigned int)nChecks,
+        0.001 * (GetTimeMicros() - nTimeStart), fValid ? "" : " (invalid script in batch)");
+}
+
+/** Hashes of blocks whose coinstake was already handed to PreverifyCoinStakes. Requires cs_main. */
+static mruset<uint256> setStakePreverified(MAX_BLOCKS_IN_TRANSIT_PER_PEER * 8);
+
+/**
+ * Verify the coinstake signatures of a batch of downloaded blocks in parallel on the script
+ * check threads, ahead of AcceptBlock. Valid signatures land in the signature cache, so the
+ * serial CheckProofOfStake of each block (and its ConnectBlock) only has to compute the kernel
+ * hash. Nothing is accepted or rejected here: blocks are still processed in order through
+ * ProcessNewBlock, which does the full check and punishes the peer that sent a bad one.
+ */
+static void PreverifyCoinStakes(const std::vector<CBlock>& vblock)
+{
+    if (!nScriptCheckThreads)
+        return;
+
+    LOCK(cs_main);
+    std::vector<CScriptCheck> vChecks;
+    vChecks.reserve(vblock.size());
+    BOOST_FOREACH (const CBlock& block, vblock) {
+        uint256 hash = block.GetHash();
+        if (setStakePreverified.count(hash))
+            continue;
+        setStakePreverified.insert(hash);
+        if (!block.IsProofOfStake() || mapBlockIndex.count(hash))
+            continue;
+
+        // Stakes spend outputs that are well buried, so they are in the coins view unless the
+        // block is on a fork; those are left to the serial path.
+        const CTransaction& tx = block.vtx[1];
+        const CCoins* coins = pcoinsTip->AccessCoins(tx.vin[0].prevout.hash);
+        if (!coins || !coins->IsAvailable(tx.vin[0].prevout.n))
+            continue;
+        vChecks.push_back(CScriptCheck(*coins, tx, 0, STANDARD_SCRIPT_VERIFY_FLAGS, true));
+    }
+    if (vChecks.size() < 2)
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    size_t nChecks = vChecks.size();
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    bool fValid = control.Wait();
+    LogPrint("bench", "    - Preverify %u coinstakes: %.2fms%s\n", (unsigned int)nChecks,
+        0.001 * (GetTimeMicros() - nTimeStart), fValid ? "" : " (invalid signature in batch)");
+}
+
+/**
+ * During initial sync peers deliver blocks back to back; peek at the complete "block" messages
+ * queued from the current one on and preverify their coinstakes as one batch. The blocks are
+ * kept in the peer's queuePreverifiedBlocks, one for each of those messages in order, so they
+ * are not deserialized again when processed; a new batch is only read once that is used up.
+ */
+static void PreverifyQueuedBlocks(CNode* pfrom, std::deque<CNetMessage>::iterator it)
+{
+    {
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        if (state == NULL || !state->queuePreverifiedBlocks.empty())
+            return;
+    }
+
+    std::vector<CBlock> vblock;
+    for (; it != pfrom->vRecvMsg.end() && vblock.size() < (size_t)MAX_BLOCKS_IN_TRANSIT_PER_PEER; ++it) {
+        CNetMessage& msg = *it;
+        if (!msg.complete() || msg.hdr.GetCommand() != "block")
+            break;
+        vblock.push_back(CBlock());
+        try {
+            CDataStream vRecv(msg.vRecv.begin(), msg.vRecv.end(), msg.vRecv.GetType(), msg.vRecv.GetVersion());
+            vRecv >> vblock.back();
+        } catch (const std::exception&) {
+            // Malformed messages are dealt with when they are processed
+            vblock.pop_back();
+            break;
+        }
+    }
+    PreverifyCoinStakes(vblock);
+
+    LOCK(cs_main);
+    CNodeState* state = State(pfrom->GetId());
+    if (state == NULL)
+        return;
+    for (size_t i = 0; i < vblock.size(); i++) {
+        state->queuePreverifiedBlocks.push_back(CBlock());
+        std::swap(state->queuePreverifiedBlocks.back(), vblock[i]);
+    }
+}
+
+/** Take the block of the "block" message about to be processed, if PreverifyQueuedBlocks read it */
+static bool TakePreverifiedBlock(CNode* pfrom, CBlock& block)
+{
+    LOCK(cs_main);
+    CNodeState* state = State(pfrom->GetId());
+    if (state == NULL || state->queuePreverifiedBlocks.empty())
+        return false;
+    std::swap(block, state->queuePreverifiedBlocks.front());
+    state->queuePreverifiedBlocks.pop_front();
+    return true;
+}
+
+/** Masternode gossip looked ahead at in one go */
+static const size_t MAX_PREVERIFY_MASTERNODE_MESSAGES = 256;
+
+static CCheckQueue<CMessageSignatureCheck> messagecheckqueue(128);
+
+void ThreadMessageCheck()
+{
+    RenameThread("mktcoin-msgcheck");
+    messagecheckqueue.Thread();
+}
+
+/** Payload hashes of masternode messages already handed to PreverifyQueuedMasternodeMessages */
+static mruset<uint256> setMasternodePreverified(MAX_PREVERIFY_MASTERNODE_MESSAGES * 8);
+
+/**
+ * A list sync (a dseg answer, or the winners asked for by mnget) arrives as a long run of mnb,
+ * mnp and mnw messages. Peek at the complete ones queued behind the current message and verify
+ * their signatures as one batch on the message check threads, so they land in the signature
+ * cache. Nothing is accepted or rejected here: the messages are still processed in order by
+ * ProcessMessage, which applies them under the masternode locks and punishes bad signatures.
+ */
+static void PreverifyQueuedMasternodeMessages(CNode* pfrom, std::deque<CNetMessage>::iterator it)
+{
+    std::vector<CMessageSignatureCheck> vChecks;
+    for (size_t nMessages = 0; it != pfrom->vRecvMsg.end() && nMessages < MAX_PREVERIFY_MASTERNODE_MESSAGES; ++it, ++nMessages) {
+        CNetMessage& msg = *it;
+        if (!msg.complete())
+            break;
+        std::string strCommand = msg.hdr.GetCommand();
+        if (strCommand != "mnb" && strCommand != "mnp" && strCommand != "mnw")
+            break;
+        if (!setMasternodePreverified.insert(Hash(msg.vRecv.begin(), msg.vRecv.end())).second)
+            break;
+        try {
+            CDataStream vRecv(msg.vRecv.begin(), msg.vRecv.end(), msg.vRecv.GetType(), msg.vRecv.GetVersion());
+            if (strCommand == "mnb") {
+                CMasternodeBroadcast mnb;
+                vRecv >> mnb;
+                mnodeman.AddSignatureChecks(mnb, vChecks);
+            } else if (strCommand == "mnp") {
+                CMasternodePing mnp;
+                vRecv >> mnp;
+                mnodeman.AddSignatureChecks(mnp, vChecks);
+            } else {
+                CMasternodePaymentWinner winner;
+                vRecv >> winner;
+                masternodePayments.AddSignatureChecks(winner, vChecks);
+            }
+        } catch (const std::exception&) {
+            // Malformed messages are dealt with when they are processed
+            break;
+        }
+    }
+    if (vChecks.size() < 2)
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    size_t nChecks = vChecks.size();
+    CCheckQueueControl<CMessageSignatureCheck> control(&messagecheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+    LogPrint("bench", "    - Preverify %u masternode message signatures: %.2fms\n", (unsigned int)nChecks,
+        0.001 * (GetTimeMicros() - nTimeStart));
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -2166,8 +2904,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     AssertLockHeld(cs_main);
     // Check it again in case a previous version let a bad block in
-    if (!fAlreadyChecked && !CheckBlock(block, state, !fJustCheck, !fJustCheck))
-        return false;
+    if (!fAlreadyChecked) {
+        bool fCheckPOW = !fJustCheck;
+        if (fCheckPOW && block.IsProofOfWork()) {
+            if (!CheckBlockIndexPoW(block, pindex))
+                return state.DoS(50, error("ConnectBlock() : proof of work failed"),
+                    REJECT_INVALID, "high-hash");
+            fCheckPOW = false;
+        }
+        if (!CheckBlock(block, state, fCheckPOW, !fJustCheck))
+            return false;
+    }
 
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == NULL ? uint256(0) : pindex->pprev->GetBlockHash();
@@ -2237,6 +2984,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspent;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpentIndex;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     CAmount nValueOut = 0;
     CAmount nValueIn = 0;
@@ -2272,9 +3022,38 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
+
+            // The inputs are still in the view until UpdateCoins below
+            if (fAddressIndex && !fJustCheck) {
+                const uint256 txhash = tx.GetHash();
+                for (unsigned int k = 0; k < tx.vin.size(); k++) {
+                    const COutPoint& prevout = tx.vin[k].prevout;
+                    const CTxOut& out = view.GetOutputFor(tx.vin[k]);
+                    uint160 hashBytes;
+                    int type = GetAddressIndexType(out.scriptPubKey, hashBytes);
+                    if (type != ADDRESS_INDEX_NONE) {
+                        vAddressIndex.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, txhash, k, true), -out.nValue));
+                        vAddressUnspent.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, prevout.hash, prevout.n), CAddressUnspentValue()));
+                    }
+                    vSpentIndex.push_back(std::make_pair(CSpentIndexKey(prevout.hash, prevout.n), CSpentIndexValue(txhash, k, pindex->nHeight, out.nValue, type, hashBytes)));
+                }
+            }
         }
         nValueOut += tx.GetValueOut();
 
+        if (fAddressIndex && !fJustCheck) {
+            const uint256 txhash = tx.GetHash();
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                const CTxOut& out = tx.vout[k];
+                uint160 hashBytes;
+                int type = GetAddressIndexType(out.scriptPubKey, hashBytes);
+                if (type == ADDRESS_INDEX_NONE)
+                    continue;
+                vAddressIndex.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, pindex->nHeight, txhash, k, false), out.nValue));
+                vAddressUnspent.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
+            }
+        }
+
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -2368,6 +3147,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     int64_t nTime2 = GetTimeMicros();
     nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs - 1), nTimeVerify * 0.000001);
+    if (fDebug) {
+        uint64_t nSigCacheHits, nSigCacheMisses;
+        GetSignatureCacheStats(nSigCacheHits, nSigCacheMisses);
+        LogPrint("bench", "    - Signature cache: %u hits, %u misses\n", nSigCacheHits, nSigCacheMisses);
+    }
 
     if (fJustCheck)
         return true;
@@ -2394,6 +3178,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort("Failed to write transaction index");
 
+    if (fAddressIndex) {
+        if (!pblocktree->WriteAddressIndex(vAddressIndex))
+            return state.Abort("Failed to write address index");
+        if (!pblocktree->UpdateAddressUnspentIndex(vAddressUnspent))
+            return state.Abort("Failed to write address unspent index");
+        if (!pblocktree->UpdateSpentIndex(vSpentIndex))
+            return state.Abort("Failed to write spent index");
+    }
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2429,8 +3222,12 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
     try {
-        if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+        size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+        // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
+        bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0 / 9) > nCoinCacheUsage;
+        // The cache is over the limit, we have to write now.
+        bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize > nCoinCacheUsage;
+        if ((mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical ||
             (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
             // Typical CCoins structures on disk are around 100 bytes in size.
             // Pushing a new one to the database can cause it to be written
@@ -2459,9 +3256,32 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                 }
                 setDirtyBlockIndex.erase(it++);
             }
+            if (!setDirtyPoWHash.empty()) {
+                std::vector<std::pair<uint256, uint256> > vPoWHash;
+                vPoWHash.reserve(setDirtyPoWHash.size());
+                BOOST_FOREACH (const CBlockIndex* pindex, setDirtyPoWHash)
+                    vPoWHash.push_back(make_pair(pindex->GetBlockHash(), pindex->hashPoW));
+                if (!pblocktree->WritePoWHashIndex(vPoWHash)) {
+                    return state.Abort("Failed to write to block index");
+                }
+                setDirtyPoWHash.clear();
+            }
+            if (!FlushStakeModifierIndex()) {
+                return state.Abort("Failed to write to block index");
+            }
             pblocktree->Sync();
             // Finally flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            if (fPartialFlush) {
+                // Keep the recently modified coins cached, and only drop the
+                // read-only ones when we are flushing to free memory. If that
+                // does not free enough, fall back to emptying the cache, so we
+                // don't end up flushing on every block.
+                bool fFreeMemory = fCacheLarge || fCacheCritical;
+                if (!pcoinsTip->PartialFlush(fFreeMemory))
+                    return state.Abort("Failed to write to coin database");
+                if (fFreeMemory && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage / 2 && !pcoinsTip->Flush())
+                    return state.Abort("Failed to write to coin database");
+            } else if (!pcoinsTip->Flush())
                 return state.Abort("Failed to write to coin database");
             // Update best block in wallet (so we can detect restored wallets).
             if (mode != FLUSH_STATE_IF_NEEDED) {
@@ -2490,10 +3310,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-        Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+        Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -2585,7 +3405,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
     if (!pblock) {
-        if (!ReadBlockFromDisk(block, pindexNew))
+        if (!TakePrefetchedBlock(pindexNew->GetBlockHash(), block) && !ReadBlockFromDisk(block, pindexNew))
             return state.Abort("Failed to read block");
         pblock = &block;
     }
@@ -2841,6 +3661,12 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
 
         // Connect new blocks.
         BOOST_REVERSE_FOREACH (CBlockIndex* pindexConnect, vpindexToConnect) {
+            // Have the next block read, and the coins it spends fetched, while this one connects.
+            if (pindexConnect != pindexMostWork) {
+                CBlockIndex* pindexNext = pindexMostWork->GetAncestor(pindexConnect->nHeight + 1);
+                if ((pindexNext != pindexMostWork || !pblock) && (pindexNext->nStatus & BLOCK_HAVE_DATA))
+                    PrefetchBlock(pindexNext);
+            }
             if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL, fAlreadyChecked)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
@@ -3198,22 +4024,28 @@ bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigne
     return true;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW, uint256* phashPoW)
 {
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(), block.nBits))
-        return state.DoS(50, error("CheckBlockHeader() : proof of work failed"),
-            REJECT_INVALID, "high-hash");
+    if (fCheckPOW) {
+        uint256 hashPoW = block.GetPoWHash();
+        if (!CheckProofOfWork(hashPoW, block.nBits))
+            return state.DoS(50, error("CheckBlockHeader() : proof of work failed"),
+                REJECT_INVALID, "high-hash");
+        // Hand the X17 hash back, so AcceptBlock can keep it without hashing again
+        if (phashPoW)
+            *phashPoW = hashPoW;
+    }
 
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig)
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig, uint256* phashPoW)
 {
     // These are checks that are independent of context.
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, block.IsProofOfWork() && fCheckPOW)) {
+    if (!CheckBlockHeader(block, state, block.IsProofOfWork() && fCheckPOW, phashPoW)) {
             return state.DoS(100, error("CheckBlock() : CheckBlockHeader failed"),
                 REJECT_INVALID, "bad-header", true);
     }
@@ -3477,7 +4309,7 @@ bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex
     return true;
 }
 
-bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex, CDiskBlockPos* dbp, bool fAlreadyCheckedBlock)
+bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex, CDiskBlockPos* dbp, bool fAlreadyCheckedBlock, const uint256& hashPoWChecked)
 {
     AssertLockHeld(cs_main);
 
@@ -3527,7 +4359,8 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         return true;
     }
 
-    if ((!fAlreadyCheckedBlock && !CheckBlock(block, state)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
+    uint256 hashPoW = fAlreadyCheckedBlock ? hashPoWChecked : uint256(0);
+    if ((!fAlreadyCheckedBlock && !CheckBlock(block, state, true, true, true, &hashPoW)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -3535,6 +4368,10 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         return false;
     }
 
+    // Remember the verified PoW hash, so connecting and rereading the block skip X17
+    if (!CheckBlockIndexPoW(block, pindex, hashPoW))
+        return state.DoS(50, error("AcceptBlock() : proof of work failed"), REJECT_INVALID, "high-hash");
+
     int nHeight = pindex->nHeight;
     int splitHeight = -1;
 
@@ -3726,7 +4563,8 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     // Preliminary checks
     int64_t nStartTime = GetTimeMillis();
 
-    bool checked = CheckBlock(*pblock, state);
+    uint256 hashPoW = 0;
+    bool checked = CheckBlock(*pblock, state, true, true, true, &hashPoW);
 
     if (!pblock->CheckBlockSignature())
         return error("ProcessNewBlock() : bad proof-of-stake block signature");
@@ -3751,7 +4589,7 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
 
         // Store to disk
         CBlockIndex* pindex = nullptr;
-        bool ret = AcceptBlock (*pblock, state, &pindex, dbp, checked);
+        bool ret = AcceptBlock (*pblock, state, &pindex, dbp, checked, hashPoW);
 
         if (pindex && pfrom) {
             mapBlockSource[pindex->GetBlockHash ()] = pfrom->GetId ();
@@ -3931,8 +4769,12 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
 
 bool static LoadBlockIndexDB()
 {
+    // Nothing else uses the index yet, but the memoized links are only touched under cs_main
+    LOCK(cs_main);
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
+    if (!pblocktree->LoadPoWHashIndex())
+        return false;
 
     boost::this_thread::interruption_point();
 
@@ -4016,6 +4858,10 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have an address index
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    LogPrintf("LoadBlockIndexDB(): address index %s\n", fAddressIndex ? "enabled" : "disabled");
+
     // If this is written true before the next client init, then we know the shutdown process failed
     pblocktree->WriteFlag("shutdown", false);
 
@@ -4027,6 +4873,10 @@ bool static LoadBlockIndexDB()
 
     PruneBlockIndexCandidates();
 
+    // Memoized stake modifier links are only kept for the active chain
+    if (!pblocktree->LoadStakeModifierIndex())
+        return false;
+
     LogPrintf("LoadBlockIndexDB(): hashBestChain=%s height=%d date=%s progress=%f\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(),
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
@@ -4073,7 +4923,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
         if (!ReadBlockFromDisk(block, pindex))
             return error("VerifyDB() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state))
+        if (nCheckLevel >= 1 && (!CheckBlockIndexPoW(block, pindex) || !CheckBlock(block, state, false)))
             return error("VerifyDB() : *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 2: verify undo validity
         if (nCheckLevel >= 2 && pindex) {
@@ -4085,7 +4935,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean)) {
                 LogPrintf("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -4151,6 +5001,9 @@ bool InitBlockIndex()
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", true);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    // Use the provided setting for -addressindex in the new database
+    fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4714,7 +5567,7 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
-bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
+bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived, CBlock* pblockRecv)
 {
     RandAddSeedPerfmon();
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -5279,7 +6132,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CBlock block;
-        vRecv >> block;
+        if (pblockRecv != NULL)
+            std::swap(block, *pblockRecv);
+        else
+            vRecv >> block;
         uint256 hashBlock = block.GetHash();
         CInv inv(MSG_BLOCK, hashBlock);
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
@@ -5621,6 +6477,15 @@ bool ProcessMessages(CNode* pfrom)
         // at this point, any failure means we can delete the current message
         it++;
 
+        // A block read ahead belongs to this message even if it is dropped below
+        CBlock blockRecv;
+        bool fBlockRecv = false;
+        if (msg.hdr.GetCommand() == "block") {
+            if (nScriptCheckThreads && IsInitialBlockDownload())
+                PreverifyQueuedBlocks(pfrom, it - 1);
+            fBlockRecv = TakePreverifiedBlock(pfrom, blockRecv);
+        }
+
         // Scan for message start
         if (memcmp(msg.hdr.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0) {
             LogPrintf("PROCESSMESSAGE: INVALID MESSAGESTART %s peer=%d\n", SanitizeString(msg.hdr.GetCommand()), pfrom->id);
@@ -5653,7 +6518,10 @@ bool ProcessMessages(CNode* pfrom)
         // Process message
         bool fRet = false;
         try {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            if ((strCommand == "mnb" || strCommand == "mnp" || strCommand == "mnw") && nScriptCheckThreads &&
+                     !fLiteMode && masternodeSync.IsBlockchainSynced())
+                PreverifyQueuedMasternodeMessages(pfrom, it - 1);
+            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, fBlockRecv ? &blockRecv : NULL);
             boost::this_thread::interruption_point();
         } catch (std::ios_base::failure& e) {
             pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
@@ -5944,18 +6812,28 @@ bool CBlockUndo::WriteToDisk(CDiskBlockPos& pos, const uint256& hashBlock)
 
 bool CBlockUndo::ReadFromDisk(const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
-
     // Read block
     uint256 hashChecksum;
-    try {
-        filein >> *this;
-        filein >> hashChecksum;
-    } catch (std::exception& e) {
-        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    CDataStream ssUndo(SER_DISK, CLIENT_VERSION);
+    if (diskFileReadCache.Read(pos, "rev", sizeof(hashChecksum), ssUndo)) {
+        try {
+            ssUndo >> *this;
+            ssUndo >> hashChecksum;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
+
+        try {
+            filein >> *this;
+            filein >> hashChecksum;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Verify checksum
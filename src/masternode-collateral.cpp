@@ -0,0 +1,74 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternode-collateral.h"
+#include "main.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <boost/foreach.hpp>
+
+CMasternodeCollateral masternodeCollateral;
+
+void CMasternodeCollateral::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    // Spends reach us when they enter the mempool or a connected block. A
+    // spent collateral stays spent, like the masternode stays VIN_SPENT.
+    LOCK(cs);
+    if (mapCollateral.empty())
+        return;
+
+    BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+        std::map<COutPoint, bool>::iterator it = mapCollateral.find(txin.prevout);
+        if (it != mapCollateral.end() && !it->second) {
+            LogPrint("masternode", "CMasternodeCollateral::SyncTransaction - collateral %s spent by %s\n", txin.prevout.ToString(), tx.GetHash().ToString());
+            it->second = true;
+        }
+    }
+}
+
+bool CMasternodeCollateral::IsSpent(const COutPoint& outpoint, bool& fSpent)
+{
+    {
+        LOCK(cs);
+        std::map<COutPoint, bool>::const_iterator it = mapCollateral.find(outpoint);
+        if (it != mapCollateral.end()) {
+            fSpent = it->second;
+            return true;
+        }
+    }
+
+    // Held until the result is stored, so no spend can come in between
+    TRY_LOCK(cs_main, lockMain);
+    if (!lockMain) return false;
+
+    {
+        LOCK(mempool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        CCoins coins;
+        fSpent = !viewMemPool.GetCoins(outpoint.hash, coins) || !coins.IsAvailable(outpoint.n) || mempool.mapNextTx.count(outpoint);
+    }
+
+    LOCK(cs);
+    mapCollateral[outpoint] = fSpent;
+    return true;
+}
+
+void CMasternodeCollateral::Forget(const COutPoint& outpoint)
+{
+    LOCK(cs);
+    mapCollateral.erase(outpoint);
+}
+
+void CMasternodeCollateral::Clear()
+{
+    LOCK(cs);
+    mapCollateral.clear();
+}
+
+size_t CMasternodeCollateral::size() const
+{
+    LOCK(cs);
+    return mapCollateral.size();
+}
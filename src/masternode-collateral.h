@@ -0,0 +1,47 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef MASTERNODE_COLLATERAL_H
+#define MASTERNODE_COLLATERAL_H
+
+#include "primitives/transaction.h"
+#include "sync.h"
+#include "validationinterface.h"
+
+#include <map>
+
+class CMasternodeCollateral;
+extern CMasternodeCollateral masternodeCollateral;
+
+//
+// CMasternodeCollateral : Follows the collateral outputs of the known masternodes
+// through the transactions accepted to the mempool and connected in blocks, so
+// checking a masternode doesn't validate a transaction spending its collateral
+//
+
+class CMasternodeCollateral : public CValidationInterface
+{
+private:
+    mutable CCriticalSection cs;
+    //! Watched collaterals, and whether they were spent
+    std::map<COutPoint, bool> mapCollateral;
+
+protected:
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+
+public:
+    /**
+     * Whether outpoint is spent, in the chain or in the mempool. The first call
+     * for an outpoint looks it up and watches it from then on; returns false if
+     * that can't be done right now because cs_main is busy.
+     */
+    bool IsSpent(const COutPoint& outpoint, bool& fSpent);
+    //! Stop watching outpoint, once its masternode is removed
+    void Forget(const COutPoint& outpoint);
+    //! Stop watching all outpoints, when the masternode list is cleared
+    void Clear();
+    //! Number of watched outpoints
+    size_t size() const;
+};
+
+#endif
@@ -431,14 +431,25 @@ void CMasternodePayments::ProcessMessageMasternodePayments(CNode* pfrom, std::st
     }
 }
 
+void CMasternodePayments::AddSignatureChecks(CMasternodePaymentWinner& winner, std::vector<CMessageSignatureCheck>& vChecks)
+{
+    {
+        LOCK(cs_mapMasternodePayeeVotes);
+        if (mapMasternodePayeeVotes.count(winner.GetHash()))
+            return;
+    }
+
+    CMasternode* pmn = mnodeman.Find(winner.vinMasternode);
+    if (pmn != NULL)
+        vChecks.push_back(CMessageSignatureCheck(pmn->pubKeyMasternode, winner.vchSig, winner.GetStrMessage()));
+}
+
 bool CMasternodePaymentWinner::Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode)
 {
     std::string errorMessage;
     std::string strMasterNodeSignMessage;
 
-    std::string strMessage = vinMasternode.prevout.ToStringShort() +
-                             boost::lexical_cast<std::string>(nBlockHeight) +
-                             payee.ToString();
+    std::string strMessage = GetStrMessage();
 
     if (!obfuScationSigner.SignMessage(strMessage, errorMessage, vchSig, keyMasternode)) {
         LogPrintf("CMasternodePing::Sign() - Error: %s\n", errorMessage.c_str());
@@ -513,13 +524,61 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
             CMasternodeBlockPayees blockPayees(winnerIn.nBlockHeight);
             mapMasternodeBlocks[winnerIn.nBlockHeight] = blockPayees;
         }
-    }
 
-    mapMasternodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+        mapMasternodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+        if (mapMasternodeBlocks[winnerIn.nBlockHeight].HasPayeeWithVotes(winnerIn.payee, MNPAYMENTS_LASTPAID_VOTES))
+            AddPayeeHeight(winnerIn.nBlockHeight, winnerIn.payee);
+    }
 
     return true;
 }
 
+void CMasternodePayments::AddPayeeHeight(int nBlockHeight, const CScript& payee)
+{
+    AssertLockHeld(cs_mapMasternodeBlocks);
+    mapPayeeHeights[payee].insert(nBlockHeight);
+}
+
+void CMasternodePayments::RemovePayeeHeights(int nBlockHeight)
+{
+    AssertLockHeld(cs_mapMasternodeBlocks);
+    std::map<int, CMasternodeBlockPayees>::iterator itBlock = mapMasternodeBlocks.find(nBlockHeight);
+    if (itBlock == mapMasternodeBlocks.end()) return;
+
+    LOCK(cs_vecPayments);
+    BOOST_FOREACH (const CMasternodePayee& p, itBlock->second.vecPayments) {
+        std::map<CScript, std::set<int> >::iterator it = mapPayeeHeights.find(p.scriptPubKey);
+        if (it == mapPayeeHeights.end()) continue;
+        it->second.erase(nBlockHeight);
+        if (it->second.empty()) mapPayeeHeights.erase(it);
+    }
+}
+
+void CMasternodePayments::RebuildPayeeHeights()
+{
+    LOCK2(cs_mapMasternodeBlocks, cs_vecPayments);
+    mapPayeeHeights.clear();
+
+    std::map<int, CMasternodeBlockPayees>::const_iterator it;
+    for (it = mapMasternodeBlocks.begin(); it != mapMasternodeBlocks.end(); ++it) {
+        BOOST_FOREACH (const CMasternodePayee& p, it->second.vecPayments)
+            if (p.nVotes >= MNPAYMENTS_LASTPAID_VOTES) AddPayeeHeight(it->first, p.scriptPubKey);
+    }
+}
+
+int CMasternodePayments::GetLastPaidHeight(const CScript& payee, int nMaxHeight)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    std::map<CScript, std::set<int> >::const_iterator it = mapPayeeHeights.find(payee);
+    if (it == mapPayeeHeights.end()) return 0;
+
+    // Votes reach a few blocks past the tip, those don't count yet
+    std::set<int>::const_iterator itHeight = it->second.upper_bound(nMaxHeight);
+    if (itHeight == it->second.begin()) return 0;
+    return *(--itHeight);
+}
+
 bool CMasternodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
 {
     LOCK(cs_vecPayments);
@@ -648,6 +707,7 @@ void CMasternodePayments::CleanPaymentList()
             LogPrint("mnpayments", "CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", winner.nBlockHeight);
             masternodeSync.mapSeenSyncMNW.erase((*it).first);
             mapMasternodePayeeVotes.erase(it++);
+            RemovePayeeHeights(winner.nBlockHeight);
             mapMasternodeBlocks.erase(winner.nBlockHeight);
         } else {
             ++it;
@@ -762,14 +822,19 @@ void CMasternodePaymentWinner::Relay()
     RelayInv(inv);
 }
 
+std::string CMasternodePaymentWinner::GetStrMessage() const
+{
+    return vinMasternode.prevout.ToStringShort() +
+           boost::lexical_cast<std::string>(nBlockHeight) +
+           payee.ToString();
+}
+
 bool CMasternodePaymentWinner::SignatureValid()
 {
     CMasternode* pmn = mnodeman.Find(vinMasternode);
 
     if (pmn != NULL) {
-        std::string strMessage = vinMasternode.prevout.ToStringShort() +
-                                 boost::lexical_cast<std::string>(nBlockHeight) +
-                                 payee.ToString();
+        std::string strMessage = GetStrMessage();
 
         std::string errorMessage = "";
         if (!obfuScationSigner.VerifyMessage(pmn->pubKeyMasternode, vchSig, strMessage, errorMessage)) {
@@ -20,11 +20,14 @@ extern CCriticalSection cs_mapMasternodePayeeVotes;
 class CMasternodePayments;
 class CMasternodePaymentWinner;
 class CMasternodeBlockPayees;
+class CMessageSignatureCheck;
 
 extern CMasternodePayments masternodePayments;
 
 #define MNPAYMENTS_SIGNATURES_REQUIRED 6
 #define MNPAYMENTS_SIGNATURES_TOTAL 10
+// Votes a payee needs in a block for the masternode to count as paid in it
+#define MNPAYMENTS_LASTPAID_VOTES 2
 
 void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 bool IsBlockPayeeValid(const CBlock& block, int nBlockHeight);
@@ -196,6 +199,8 @@ public:
     bool IsValid(CNode* pnode, std::string& strError);
     bool SignatureValid();
     void Relay();
+    //! The message signed by the masternode key
+    std::string GetStrMessage() const;
 
     void AddPayee(CScript payeeIn)
     {
@@ -235,6 +240,12 @@ class CMasternodePayments
 private:
     int nSyncedFromPeer;
     int nLastBlockHeight;
+    //! Heights of the blocks each payee has MNPAYMENTS_LASTPAID_VOTES votes in,
+    //! which saves walking the chain for the last payment of every masternode
+    std::map<CScript, std::set<int> > mapPayeeHeights;
+
+    void AddPayeeHeight(int nBlockHeight, const CScript& payee);
+    void RemovePayeeHeights(int nBlockHeight);
 
 public:
     std::map<uint256, CMasternodePaymentWinner> mapMasternodePayeeVotes;
@@ -252,6 +263,7 @@ public:
         LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePayeeVotes);
         mapMasternodeBlocks.clear();
         mapMasternodePayeeVotes.clear();
+        mapPayeeHeights.clear();
     }
 
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
@@ -260,6 +272,10 @@ public:
     void Sync(CNode* node, int nCountNeeded);
     void CleanPaymentList();
     int LastPayment(CMasternode& mn);
+    //! Index mapMasternodeBlocks again, after it was filled without AddWinningMasternode
+    void RebuildPayeeHeights();
+    //! The last height up to nMaxHeight with payee voted in, 0 if none
+    int GetLastPaidHeight(const CScript& payee, int nMaxHeight);
 
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
@@ -282,6 +298,8 @@ public:
 
     int GetMinMasternodePaymentsProto();
     void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    //! Add the signature check ProcessMessageMasternodePayments will do for a winner, unless it was seen before
+    void AddSignatureChecks(CMasternodePaymentWinner& winner, std::vector<CMessageSignatureCheck>& vChecks);
     std::string GetRequiredPaymentsString(int nBlockHeight);
     void FillBlockPayee(CMutableTransaction& txNew, int64_t nFees, bool fProofOfStake);
     std::string ToString() const;
@@ -295,6 +313,8 @@ public:
     {
         READWRITE(mapMasternodePayeeVotes);
         READWRITE(mapMasternodeBlocks);
+        if (ser_action.ForRead())
+            RebuildPayeeHeights();
     }
 };
 
@@ -63,6 +63,8 @@ public:
     bool CheckAndUpdate(int& nDos, bool fRequireEnabled = true);
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     void Relay();
+    //! The message signed by the masternode key
+    std::string GetStrMessage() const;
 
     uint256 GetHash()
     {
@@ -192,6 +194,8 @@ public:
     }
 
     uint256 CalculateScore(int mod = 1, int64_t nBlockHeight = 0);
+    //! Score against the hash of the block, which is looked up once for all masternodes
+    uint256 CalculateScore(const uint256& hashBlock);
 
     ADD_SERIALIZE_METHODS;
 
@@ -218,9 +222,10 @@ public:
         READWRITE(nLastScanningErrorBlockHeight);
     }
 
-    int64_t SecondsSincePayment();
+    int64_t SecondsSincePayment(int nMaxBlocks);
 
-    bool UpdateFromNewBroadcast(CMasternodeBroadcast& mnb);
+    //! fKeysChanged is set when the masternode or collateral key changed, which CMasternodeMan indexes by
+    bool UpdateFromNewBroadcast(CMasternodeBroadcast& mnb, bool& fKeysChanged);
 
     inline uint64_t SliceHash(uint256& hash, int slice)
     {
@@ -282,6 +287,8 @@ public:
     }
 
     int64_t GetLastPaid();
+    //! Time of the last payment within the last nMaxBlocks blocks, 0 if none
+    int64_t GetLastPaid(int nMaxBlocks);
     bool IsValidNetAddr();
 };
 
@@ -301,6 +308,8 @@ public:
     bool CheckInputsAndAdd(int& nDos);
     bool Sign(CKey& keyCollateralAddress);
     void Relay();
+    //! The message signed by the collateral key
+    std::string GetStrMessage() const;
 
     ADD_SERIALIZE_METHODS;
 
@@ -8,6 +8,7 @@
 #include "activemasternode.h"
 #include "addrman.h"
 #include "masternode.h"
+#include "masternode-collateral.h"
 #include "obfuscation.h"
 #include "spork.h"
 #include "util.h"
@@ -25,19 +26,11 @@ struct CompareLastPaid {
     }
 };
 
-struct CompareScoreTxIn {
-    bool operator()(const pair<int64_t, CTxIn>& t1,
-        const pair<int64_t, CTxIn>& t2) const
+struct CompareScoreIndex {
+    bool operator()(const pair<int64_t, size_t>& t1,
+        const pair<int64_t, size_t>& t2) const
     {
-        return t1.first < t2.first;
-    }
-};
-
-struct CompareScoreMN {
-    bool operator()(const pair<int64_t, CMasternode>& t1,
-        const pair<int64_t, CMasternode>& t2) const
-    {
-        return t1.first < t2.first;
+        return t1.first > t2.first || (t1.first == t2.first && t1.second < t2.second);
     }
 };
 
@@ -208,6 +201,8 @@ bool CMasternodeMan::Add(CMasternode& mn)
     if (pmn == NULL) {
         LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        AddToIndexes(vMasternodes.size() - 1);
+        mapScoreCache.clear();
         return true;
     }
 
@@ -246,6 +241,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
     LOCK(cs);
 
     //remove inactive and outdated
+    bool fRemoved = false;
     vector<CMasternode>::iterator it = vMasternodes.begin();
     while (it != vMasternodes.end()) {
         if ((*it).activeState == CMasternode::MASTERNODE_REMOVE ||
@@ -277,11 +273,17 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
                 }
             }
 
+            masternodeCollateral.Forget((*it).vin.prevout);
             it = vMasternodes.erase(it);
+            fRemoved = true;
         } else {
             ++it;
         }
     }
+    if (fRemoved) {
+        mapScoreCache.clear();
+        RebuildIndexes();
+    }
 
     // check who's asked for the Masternode list
     map<CNetAddr, int64_t>::iterator it1 = mAskedUsForMasternodeList.begin();
@@ -339,6 +341,9 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    masternodeCollateral.Clear();
+    mapScoreCache.clear();
+    RebuildIndexes();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -434,28 +439,57 @@ void CMasternodeMan::DsegUpdate(CNode* pnode)
     mWeAskedForMasternodeList[pnode->addr] = askAgain;
 }
 
+void CMasternodeMan::AddToIndexes(size_t nIndex)
+{
+    AssertLockHeld(cs);
+
+    const CMasternode& mn = vMasternodes[nIndex];
+    mapIndexByVin.insert(make_pair(mn.vin.prevout, nIndex));
+    mapIndexByPayee.insert(make_pair(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()), nIndex));
+    mapIndexByPubKey.insert(make_pair(mn.pubKeyMasternode, nIndex));
+}
+
+void CMasternodeMan::RebuildIndexes()
+{
+    LOCK(cs);
+
+    mapIndexByVin.clear();
+    mapIndexByPayee.clear();
+    mapIndexByPubKey.clear();
+    for (size_t i = 0; i < vMasternodes.size(); i++)
+        AddToIndexes(i);
+}
+
+bool CMasternodeMan::UpdateFromNewBroadcast(CMasternode& mn, CMasternodeBroadcast& mnb)
+{
+    LOCK(cs);
+
+    bool fKeysChanged;
+    if (!mn.UpdateFromNewBroadcast(mnb, fKeysChanged))
+        return false;
+    if (fKeysChanged)
+        RebuildIndexes();
+    return true;
+}
+
 CMasternode* CMasternodeMan::Find(const CScript& payee)
 {
     LOCK(cs);
-    CScript payee2;
 
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
-        payee2 = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
-        if (payee2 == payee)
-            return &mn;
-    }
-    return NULL;
+    std::map<CScript, size_t>::const_iterator it = mapIndexByPayee.find(payee);
+    if (it == mapIndexByPayee.end())
+        return NULL;
+    return &vMasternodes[it->second];
 }
 
 CMasternode* CMasternodeMan::Find(const CTxIn& vin)
 {
     LOCK(cs);
 
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
-        if (mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    std::map<COutPoint, size_t>::const_iterator it = mapIndexByVin.find(vin.prevout);
+    if (it == mapIndexByVin.end())
+        return NULL;
+    return &vMasternodes[it->second];
 }
 
 
@@ -463,11 +497,10 @@ CMasternode* CMasternodeMan::Find(const CPubKey& pubKeyMasternode)
 {
     LOCK(cs);
 
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
-        if (mn.pubKeyMasternode == pubKeyMasternode)
-            return &mn;
-    }
-    return NULL;
+    std::map<CPubKey, size_t>::const_iterator it = mapIndexByPubKey.find(pubKeyMasternode);
+    if (it == mapIndexByPubKey.end())
+        return NULL;
+    return &vMasternodes[it->second];
 }
 
 //
@@ -485,6 +518,8 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     */
 
     int nMnCount = CountEnabled();
+    // How far back the last payment is looked for, the same for every masternode
+    int nMaxBlocks = nMnCount * 1.25;
     BOOST_FOREACH (CMasternode& mn, vMasternodes) {
         mn.Check();
         if (!mn.IsEnabled()) continue;
@@ -501,7 +536,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
         //make sure it has as many confirmations as there are masternodes
         if (mn.GetMasternodeInputAge() < nMnCount) continue;
 
-        vecMasternodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(), mn.vin));
+        vecMasternodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(nMaxBlocks), mn.vin));
     }
 
     nCount = (int)vecMasternodeLastPaid.size();
@@ -546,18 +581,14 @@ CMasternode* CMasternodeMan::FindRandomNotInVec(std::vector<CTxIn>& vecToExclude
 
     int rand = GetRandInt(nCountEnabled - vecToExclude.size());
     LogPrint("masternode", "CMasternodeMan::FindRandomNotInVec - rand %d\n", rand);
-    bool found;
+
+    std::set<COutPoint> setToExclude;
+    BOOST_FOREACH (CTxIn& usedVin, vecToExclude)
+        setToExclude.insert(usedVin.prevout);
 
     BOOST_FOREACH (CMasternode& mn, vMasternodes) {
         if (mn.protocolVersion < protocolVersion || !mn.IsEnabled()) continue;
-        found = false;
-        BOOST_FOREACH (CTxIn& usedVin, vecToExclude) {
-            if (mn.vin.prevout == usedVin.prevout) {
-                found = true;
-                break;
-            }
-        }
-        if (found) continue;
+        if (setToExclude.count(mn.vin.prevout)) continue;
         if (--rand < 1) {
             return &mn;
         }
@@ -566,48 +597,75 @@ CMasternode* CMasternodeMan::FindRandomNotInVec(std::vector<CTxIn>& vecToExclude
     return NULL;
 }
 
+const std::vector<pair<int64_t, size_t> >* CMasternodeMan::GetScores(int64_t nBlockHeight)
+{
+    AssertLockHeld(cs);
+
+    //make sure we know about this block
+    uint256 hash = 0;
+    if (!GetBlockHash(hash, nBlockHeight)) return NULL;
+
+    std::map<int64_t, CMasternodeScores>::iterator it = mapScoreCache.find(nBlockHeight);
+    if (it != mapScoreCache.end() && it->second.hashBlock == hash)
+        return &it->second.vScores;
+
+    if (it == mapScoreCache.end() && mapScoreCache.size() >= MASTERNODES_SCORE_CACHE_HEIGHTS)
+        mapScoreCache.erase(mapScoreCache.begin());
+
+    CMasternodeScores& scores = mapScoreCache[nBlockHeight];
+    scores.hashBlock = hash;
+    scores.vScores.clear();
+    scores.vScores.reserve(vMasternodes.size());
+    for (size_t i = 0; i < vMasternodes.size(); i++)
+        scores.vScores.push_back(make_pair(vMasternodes[i].CalculateScore(hash).GetCompact(false), i));
+
+    // ties go to the MN earlier in the list
+    sort(scores.vScores.begin(), scores.vScores.end(), CompareScoreIndex());
+
+    return &scores.vScores;
+}
+
 CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight, int minProtocol)
 {
-    int64_t score = 0;
-    CMasternode* winner = NULL;
+    LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
+    const std::vector<pair<int64_t, size_t> >* pScores = GetScores(nBlockHeight);
+    if (pScores == NULL) return NULL;
+
+    // the winner is the first one enabled, scores are sorted
+    BOOST_FOREACH (const PAIRTYPE(int64_t, size_t) & s, *pScores) {
+        if (s.first <= 0) break;
+
+        CMasternode& mn = vMasternodes[s.second];
         mn.Check();
         if (mn.protocolVersion < minProtocol || !mn.IsEnabled()) continue;
 
-        // calculate the score for each Masternode
-        uint256 n = mn.CalculateScore(mod, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        // determine the winner
-        if (n2 > score) {
-            score = n2;
-            winner = &mn;
-        }
+        return &mn;
     }
 
-    return winner;
+    return NULL;
 }
 
 int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
+
     int64_t nMasternode_Min_Age = GetSporkValue(SPORK_16_MN_WINNER_MINIMUM_AGE);
     int64_t nMasternode_Age = 0;
+    bool fCheckAge = IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT);
 
-    //make sure we know about this block
-    uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return -1;
+    const std::vector<pair<int64_t, size_t> >* pScores = GetScores(nBlockHeight);
+    if (pScores == NULL) return -1;
 
-    // scan for winner
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
+    int rank = 0;
+    BOOST_FOREACH (const PAIRTYPE(int64_t, size_t) & s, *pScores) {
+        CMasternode& mn = vMasternodes[s.second];
         if (mn.protocolVersion < minProtocol) {
             LogPrintf("Skipping Masternode with obsolete version %d\n", mn.protocolVersion);
             continue;                                                       // Skip obsolete versions
         }
 
-        if (IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT)) {
+        if (fCheckAge) {
             nMasternode_Age = GetAdjustedTime() - mn.sigTime;
             if ((nMasternode_Age) < nMasternode_Min_Age) {
                 if (fDebug){
@@ -620,18 +678,9 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
             mn.Check();
             if (!mn.IsEnabled()) continue;
         }
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecMasternodeScores) {
         rank++;
-        if (s.second.prevout == vin.prevout) {
+        if (mn.vin.prevout == vin.prevout) {
             return rank;
         }
     }
@@ -639,38 +688,32 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
     return -1;
 }
 
-std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
+std::vector<pair<int, CTxIn> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
 {
-    std::vector<pair<int64_t, CMasternode> > vecMasternodeScores;
-    std::vector<pair<int, CMasternode> > vecMasternodeRanks;
+    LOCK(cs);
 
-    //make sure we know about this block
-    uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return vecMasternodeRanks;
+    std::vector<pair<int64_t, size_t> > vecMasternodeScores;
+    std::vector<pair<int, CTxIn> > vecMasternodeRanks;
 
-    // scan for winner
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
+    const std::vector<pair<int64_t, size_t> >* pScores = GetScores(nBlockHeight);
+    if (pScores == NULL) return vecMasternodeRanks;
+
+    BOOST_FOREACH (const PAIRTYPE(int64_t, size_t) & s, *pScores) {
+        CMasternode& mn = vMasternodes[s.second];
         mn.Check();
 
         if (mn.protocolVersion < minProtocol) continue;
 
-        if (!mn.IsEnabled()) {
-            vecMasternodeScores.push_back(make_pair(9999, mn));
-            continue;
-        }
-
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn));
+        vecMasternodeScores.push_back(make_pair(mn.IsEnabled() ? s.first : 9999, s.second));
     }
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
+    // only the disabled ones move, down to their score of 9999
+    sort(vecMasternodeScores.begin(), vecMasternodeScores.end(), CompareScoreIndex());
 
     int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode) & s, vecMasternodeScores) {
+    BOOST_FOREACH (PAIRTYPE(int64_t, size_t) & s, vecMasternodeScores) {
         rank++;
-        vecMasternodeRanks.push_back(make_pair(rank, s.second));
+        vecMasternodeRanks.push_back(make_pair(rank, vMasternodes[s.second].vin));
     }
 
     return vecMasternodeRanks;
@@ -678,29 +721,23 @@ std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t
 
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
+    const std::vector<pair<int64_t, size_t> >* pScores = GetScores(nBlockHeight);
+    if (pScores == NULL) return NULL;
+
+    int rank = 0;
+    BOOST_FOREACH (const PAIRTYPE(int64_t, size_t) & s, *pScores) {
+        CMasternode& mn = vMasternodes[s.second];
         if (mn.protocolVersion < minProtocol) continue;
         if (fOnlyActive) {
             mn.Check();
             if (!mn.IsEnabled()) continue;
         }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
-
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecMasternodeScores) {
         rank++;
         if (rank == nRank) {
-            return Find(s.second);
+            return &mn;
         }
     }
 
@@ -942,7 +979,10 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                 if (pmn->nLastDsee < sigTime) { //take the newest entry
                     LogPrint("masternode", "dsee - Got updated entry for %s\n", vin.prevout.hash.ToString());
                     if (pmn->protocolVersion < GETHEADERS_VERSION) {
-                        pmn->pubKeyMasternode = pubkey2;
+                        if (pmn->pubKeyMasternode != pubkey2) {
+                            pmn->pubKeyMasternode = pubkey2;
+                            RebuildIndexes();
+                        }
                         pmn->sigTime = sigTime;
                         pmn->sig = vchSig;
                         pmn->protocolVersion = protocolVersion;
@@ -1035,13 +1075,21 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             mn.protocolVersion = protocolVersion;
             // fake ping
             mn.lastPing = CMasternodePing(vin);
-            mn.Check(true);
+            // AcceptableInputs just found the collateral unspent and the ping is fresh, so the
+            // entry is enabled. Only listed masternodes are checked against the collateral tracker,
+            // which stops watching a collateral once its masternode is removed.
+            bool fEnabled = true;
             // add v11 masternodes, v12 should be added by mnb only
             if (protocolVersion < GETHEADERS_VERSION) {
                 LogPrint("masternode", "dsee - Accepted OLD Masternode entry %i %i\n", count, current);
                 Add(mn);
+                CMasternode* pmn = Find(vin);
+                if (pmn) {
+                    pmn->Check(true);
+                    fEnabled = pmn->IsEnabled();
+                }
             }
-            if (mn.IsEnabled()) {
+            if (fEnabled) {
                 TRY_LOCK(cs_vNodes, lockNodes);
                 if (!lockNodes) return;
                 BOOST_FOREACH (CNode* pnode, vNodes)
@@ -1132,19 +1180,47 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
      */
 }
 
+void CMasternodeMan::AddSignatureChecks(CMasternodeBroadcast& mnb, std::vector<CMessageSignatureCheck>& vChecks)
+{
+    LOCK(cs);
+    if (mapSeenMasternodeBroadcast.count(mnb.GetHash()))
+        return;
+
+    vChecks.push_back(CMessageSignatureCheck(mnb.pubKeyCollateralAddress, mnb.sig, mnb.GetStrMessage()));
+    // The ping inside is checked against the key the broadcast announces
+    if (!mnb.lastPing.vchSig.empty() && mnb.lastPing.vin == mnb.vin)
+        vChecks.push_back(CMessageSignatureCheck(mnb.pubKeyMasternode, mnb.lastPing.vchSig, mnb.lastPing.GetStrMessage()));
+}
+
+void CMasternodeMan::AddSignatureChecks(CMasternodePing& mnp, std::vector<CMessageSignatureCheck>& vChecks)
+{
+    LOCK(cs);
+    if (mapSeenMasternodePing.count(mnp.GetHash()))
+        return;
+
+    // Pings of unknown masternodes, or that come too soon after the last one, are not verified
+    CMasternode* pmn = Find(mnp.vin);
+    if (pmn == NULL || pmn->IsPingedWithin(MASTERNODE_MIN_MNP_SECONDS - 60, mnp.sigTime))
+        return;
+    vChecks.push_back(CMessageSignatureCheck(pmn->pubKeyMasternode, mnp.vchSig, mnp.GetStrMessage()));
+}
+
 void CMasternodeMan::Remove(CTxIn vin)
 {
     LOCK(cs);
 
-    vector<CMasternode>::iterator it = vMasternodes.begin();
-    while (it != vMasternodes.end()) {
-        if ((*it).vin == vin) {
-            LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
-            vMasternodes.erase(it);
-            break;
-        }
-        ++it;
-    }
+    std::map<COutPoint, size_t>::const_iterator itIndex = mapIndexByVin.find(vin.prevout);
+    if (itIndex == mapIndexByVin.end())
+        return;
+    vector<CMasternode>::iterator it = vMasternodes.begin() + itIndex->second;
+    if ((*it).vin != vin)
+        return;
+
+    LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
+    masternodeCollateral.Forget((*it).vin.prevout);
+    vMasternodes.erase(it);
+    mapScoreCache.clear();
+    RebuildIndexes();
 }
 
 void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
@@ -1161,7 +1237,7 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
         if (Add(mn)) {
             masternodeSync.AddedMasternodeList(mnb.GetHash());
         }
-    } else if (pmn->UpdateFromNewBroadcast(mnb)) {
+    } else if (UpdateFromNewBroadcast(*pmn, mnb)) {
         masternodeSync.AddedMasternodeList(mnb.GetHash());
     }
 }
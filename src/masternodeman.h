@@ -17,10 +17,12 @@
 
 #define MASTERNODES_DUMP_SECONDS (15 * 60)
 #define MASTERNODES_DSEG_SECONDS (3 * 60 * 60)
+#define MASTERNODES_SCORE_CACHE_HEIGHTS 10
 
 using namespace std;
 
 class CMasternodeMan;
+class CMessageSignatureCheck;
 
 extern CMasternodeMan mnodeman;
 void DumpMasternodes();
@@ -67,6 +69,23 @@ private:
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
 
+    // scores of all MNs for a block, highest first, with their position in vMasternodes
+    struct CMasternodeScores {
+        uint256 hashBlock;
+        std::vector<pair<int64_t, size_t> > vScores;
+    };
+    // score tables of the last few heights asked for, dropped when vMasternodes changes
+    std::map<int64_t, CMasternodeScores> mapScoreCache;
+
+    // positions in vMasternodes by collateral, payee and masternode key; where
+    // MNs share a payee or key, the one earlier in the list is indexed
+    std::map<COutPoint, size_t> mapIndexByVin;
+    std::map<CScript, size_t> mapIndexByPayee;
+    std::map<CPubKey, size_t> mapIndexByPubKey;
+
+    const std::vector<pair<int64_t, size_t> >* GetScores(int64_t nBlockHeight);
+    void AddToIndexes(size_t nIndex);
+
 public:
     // Keep track of all broadcasts I've seen
     map<uint256, CMasternodeBroadcast> mapSeenMasternodeBroadcast;
@@ -90,6 +109,10 @@ public:
 
         READWRITE(mapSeenMasternodeBroadcast);
         READWRITE(mapSeenMasternodePing);
+        if (ser_action.ForRead()) {
+            mapScoreCache.clear();
+            RebuildIndexes();
+        }
     }
 
     CMasternodeMan();
@@ -116,6 +139,12 @@ public:
 
     void DsegUpdate(CNode* pnode);
 
+    /// Index all entries again, after the list or the keys of an entry changed
+    void RebuildIndexes();
+
+    /// Update an entry of the list from a newer broadcast, and its index entries with it
+    bool UpdateFromNewBroadcast(CMasternode& mn, CMasternodeBroadcast& mnb);
+
     /// Find an entry
     CMasternode* Find(const CScript& payee);
     CMasternode* Find(const CTxIn& vin);
@@ -136,7 +165,7 @@ public:
         return vMasternodes;
     }
 
-    std::vector<pair<int, CMasternode> > GetMasternodeRanks(int64_t nBlockHeight, int minProtocol = 0);
+    std::vector<pair<int, CTxIn> > GetMasternodeRanks(int64_t nBlockHeight, int minProtocol = 0);
     int GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
     CMasternode* GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol = 0, bool fOnlyActive = true);
 
@@ -144,6 +173,10 @@ public:
 
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 
+    /// Add the signature checks ProcessMessage will do for a gossiped mnb or mnp, unless it was seen before
+    void AddSignatureChecks(CMasternodeBroadcast& mnb, std::vector<CMessageSignatureCheck>& vChecks);
+    void AddSignatureChecks(CMasternodePing& mnp, std::vector<CMessageSignatureCheck>& vChecks);
+
     /// Return the number of (unique) Masternodes
     int size() { return vMasternodes.size(); }
 
@@ -34,27 +34,6 @@ using namespace std;
 // MktCoinMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
-    {
-    }
-};
-
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
@@ -82,6 +61,350 @@ public:
     }
 };
 
+//
+// Unconfirmed transactions in the memory pool often depend on other
+// transactions in the memory pool. The pool keeps links to those, so while
+// walking one of its orderings we pass over transactions whose parents are
+// not in the block yet, and pick them up when the last one is added.
+//
+static bool HasParentsInBlock(const CTxMemPoolEntry& entry, const set<uint256>& setInBlock)
+{
+    BOOST_FOREACH (const uint256& hashParent, entry.GetMemPoolParents())
+        if (!setInBlock.count(hashParent))
+            return false;
+    return true;
+}
+
+// The next entry of a mempool ordering that is not done yet and can go into
+// the block now, leaving the iterator on it.
+template <typename Iterator>
+static const CTxMemPoolEntry* NextMemPoolEntry(Iterator& it, Iterator end, const set<uint256>& setDone, const set<uint256>& setInBlock)
+{
+    for (; it != end; ++it) {
+        if (setDone.count(it->second))
+            continue;
+        map<uint256, CTxMemPoolEntry>::const_iterator mi = mempool.mapTx.find(it->second);
+        assert(mi != mempool.mapTx.end());
+        if (HasParentsInBlock(mi->second, setInBlock))
+            return &mi->second;
+    }
+    return NULL;
+}
+
+// Seconds the transactions of a block template are only extended with new
+// mempool transactions before they are picked again from scratch, giving the
+// ones passed over (not final yet, or crowded out) another chance.
+static const int64_t BLOCK_TEMPLATE_MAX_AGE = 60;
+
+/**
+ * The mempool transactions picked for the last block template. The next one
+ * on the same tip starts from them: as long as none of them left the mempool
+ * and no transaction was prioritised, only the transactions that entered it
+ * since are looked at. Both
+ * getblocktemplate and the miner threads get their templates through it.
+ * Guarded by cs_main and mempool.cs.
+ */
+class CBlockTemplateCache
+{
+public:
+    uint256 hashPrevBlock;
+    int nHeight;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+    int64_t nTimeCreated;              //! When the transactions were picked from scratch
+    int64_t nTimeUpdated;              //! Mempool entries from this time on were not looked at yet
+    unsigned int nTransactionsUpdated; //! mempool.GetTransactionsUpdated() at the last update
+    unsigned int nTransactionsChanged; //! mempool.GetTransactionsChanged() when the transactions were picked
+    CCoinsViewCache* pview;            //! pcoinsTip with the picked transactions applied
+
+    std::vector<CTransaction> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    set<uint256> setInBlock;
+    uint64_t nBlockSize;
+    int nBlockSigOps;
+    CAmount nFees;
+    bool fSortedByFee; //! Whether the priority part of the block is complete
+
+    CBlockTemplateCache() : pview(NULL) { Clear(); }
+    ~CBlockTemplateCache() { Clear(); }
+
+    void Clear()
+    {
+        delete pview;
+        pview = NULL;
+        hashPrevBlock = 0;
+        nHeight = 0;
+        nTimeCreated = nTimeUpdated = 0;
+        nTransactionsUpdated = 0;
+        nTransactionsChanged = 0;
+        vtx.clear();
+        vTxFees.clear();
+        vTxSigOps.clear();
+        setInBlock.clear();
+        nBlockSize = 1000;
+        nBlockSigOps = 100;
+        nFees = 0;
+        fSortedByFee = false;
+    }
+
+    //! Whether the transactions are for this tip and settings, all still in the mempool, and nothing was reprioritised since
+    bool IsCurrent(const CBlockIndex* pindexPrev, unsigned int nBlockMaxSizeIn, unsigned int nBlockPrioritySizeIn, unsigned int nBlockMinSizeIn) const
+    {
+        if (pview == NULL || hashPrevBlock != pindexPrev->GetBlockHash() || nHeight != pindexPrev->nHeight + 1)
+            return false;
+        if (nBlockMaxSize != nBlockMaxSizeIn || nBlockPrioritySize != nBlockPrioritySizeIn || nBlockMinSize != nBlockMinSizeIn)
+            return false;
+        if (GetTime() - nTimeCreated > BLOCK_TEMPLATE_MAX_AGE)
+            return false;
+        if (mempool.GetTransactionsChanged() != nTransactionsChanged)
+            return false;
+        // Removals of transactions the template passed over don't matter
+        if (mempool.GetTransactionsUpdated() != nTransactionsUpdated) {
+            BOOST_FOREACH (const CTransaction& tx, vtx)
+                if (!mempool.mapTx.count(tx.GetHash()))
+                    return false;
+        }
+        return true;
+    }
+};
+
+static CBlockTemplateCache blockTemplateCache;
+
+// Add tx to the template if its inputs are there and its scripts are valid.
+// Size and legacy sigop limits are checked by the caller.
+static bool ConnectToTemplate(CBlockTemplateCache& tmpl, const CTransaction& tx, unsigned int nTxSize, unsigned int nTxSigOps)
+{
+    CCoinsViewCache& view = *tmpl.pview;
+    if (!view.HaveInputs(tx))
+        return false;
+
+    CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
+
+    nTxSigOps += GetP2SHSigOpCount(tx, view);
+    if (tmpl.nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    CValidationState state;
+    if (!CheckInputsParallel(tx, state, view, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        return false;
+
+    CTxUndo txundo;
+    UpdateCoins(tx, state, view, txundo, tmpl.nHeight);
+
+    // Added
+    tmpl.vtx.push_back(tx);
+    tmpl.vTxFees.push_back(nTxFees);
+    tmpl.vTxSigOps.push_back(nTxSigOps);
+    tmpl.setInBlock.insert(tx.GetHash());
+    tmpl.nBlockSize += nTxSize;
+    tmpl.nBlockSigOps += nTxSigOps;
+    tmpl.nFees += nTxFees;
+    return true;
+}
+
+// Queue the children of hash whose mempool parents are all in the template now
+static void QueueReadyChildren(const CBlockTemplateCache& tmpl, const uint256& hash, set<uint256>& setDone, vector<TxPriority>& vecReady, TxPriorityCompare& comparer)
+{
+    BOOST_FOREACH (const uint256& hashChild, mempool.mapTx[hash].GetMemPoolChildren()) {
+        if (setDone.count(hashChild))
+            continue;
+        const CTxMemPoolEntry& child = mempool.mapTx[hashChild];
+        if (!HasParentsInBlock(child, tmpl.setInBlock))
+            continue;
+        setDone.insert(hashChild);
+        vecReady.push_back(TxPriority(child.GetModifiedPriority(tmpl.nHeight), child.GetModifiedFeeRate(), &child.GetTx()));
+        std::push_heap(vecReady.begin(), vecReady.end(), comparer);
+    }
+}
+
+// Pick the transactions for an empty template
+static void CreateTemplateTransactions(CBlockTemplateCache& tmpl)
+{
+    bool fPrintPriority = GetBoolArg("-printpriority", false);
+
+    // Transactions come in the order the mempool keeps them, by priority
+    // and then by fee rate. One that spends mempool transactions not in
+    // the block yet is passed over, and joins vecReady once they are.
+    set<uint256> setDone; // added, rejected or waiting in vecReady
+    vector<TxPriority> vecReady;
+
+    tmpl.fSortedByFee = (tmpl.nBlockPrioritySize <= 0);
+
+    TxPriorityCompare comparer(tmpl.fSortedByFee);
+    const CTxMemPool::TxPriorityIndex& indexByPriority = mempool.GetPriorityIndex(tmpl.nHeight);
+    const CTxMemPool::TxFeeRateIndex& indexByFeeRate = mempool.GetFeeRateIndex();
+    CTxMemPool::TxPriorityIndex::const_iterator itPriority = indexByPriority.begin();
+    CTxMemPool::TxFeeRateIndex::const_iterator itFeeRate = indexByFeeRate.begin();
+
+    while (true) {
+        const CTxMemPoolEntry* pentry = tmpl.fSortedByFee ?
+                                            NextMemPoolEntry(itFeeRate, indexByFeeRate.end(), setDone, tmpl.setInBlock) :
+                                            NextMemPoolEntry(itPriority, indexByPriority.end(), setDone, tmpl.setInBlock);
+        TxPriority next;
+        if (pentry != NULL)
+            next = TxPriority(pentry->GetModifiedPriority(tmpl.nHeight), pentry->GetModifiedFeeRate(), &pentry->GetTx());
+        if (!vecReady.empty() && (pentry == NULL || !comparer(vecReady.front(), next))) {
+            next = vecReady.front();
+            std::pop_heap(vecReady.begin(), vecReady.end(), comparer);
+            vecReady.pop_back();
+        } else if (pentry == NULL) {
+            break;
+        }
+
+        double dPriority = next.get<0>();
+        CFeeRate feeRate = next.get<1>();
+        const CTransaction& tx = *next.get<2>();
+        const uint256& hash = tx.GetHash();
+        setDone.insert(hash);
+
+        if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, tmpl.nHeight))
+            continue;
+
+        // Size limits
+        unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        if (tmpl.nBlockSize + nTxSize >= tmpl.nBlockMaxSize)
+            continue;
+
+        // Legacy limits on sigOps:
+        unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+        if (tmpl.nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            continue;
+
+        // Skip free transactions if we're past the minimum block size:
+        double dPriorityDelta = 0;
+        CAmount nFeeDelta = 0;
+        mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+        if (tmpl.fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (tmpl.nBlockSize + nTxSize >= tmpl.nBlockMinSize))
+            continue;
+
+        // Prioritise by fee once past the priority size or we run out of high-priority
+        // transactions:
+        if (!tmpl.fSortedByFee &&
+            ((tmpl.nBlockSize + nTxSize >= tmpl.nBlockPrioritySize) || !AllowFree(dPriority))) {
+            tmpl.fSortedByFee = true;
+            comparer = TxPriorityCompare(tmpl.fSortedByFee);
+            std::make_heap(vecReady.begin(), vecReady.end(), comparer);
+        }
+
+        if (!ConnectToTemplate(tmpl, tx, nTxSize, nTxSigOps))
+            continue;
+
+        if (fPrintPriority) {
+            LogPrintf("priority %.1f fee %s txid %s\n",
+                dPriority, feeRate.ToString(), tx.GetHash().ToString());
+        }
+
+        // Children whose mempool inputs are all in the block now can follow
+        QueueReadyChildren(tmpl, hash, setDone, vecReady, comparer);
+    }
+}
+
+// Add the transactions that entered the mempool since the template was last
+// updated, by fee rate, as far as they fit in what is left of the block
+static void ExtendTemplateTransactions(CBlockTemplateCache& tmpl, int64_t nTimeFrom)
+{
+    set<uint256> setDone;
+    vector<TxPriority> vecReady;
+    TxPriorityCompare comparer(true);
+
+    const CTxMemPool::TxTimeIndex& indexByTime = mempool.GetTimeIndex();
+    for (CTxMemPool::TxTimeIndex::const_iterator it = indexByTime.lower_bound(std::make_pair(nTimeFrom, uint256()));
+         it != indexByTime.end(); ++it) {
+        if (tmpl.setInBlock.count(it->second))
+            continue;
+        const CTxMemPoolEntry& entry = mempool.mapTx[it->second];
+        if (!HasParentsInBlock(entry, tmpl.setInBlock))
+            continue;
+        setDone.insert(it->second);
+        vecReady.push_back(TxPriority(entry.GetModifiedPriority(tmpl.nHeight), entry.GetModifiedFeeRate(), &entry.GetTx()));
+    }
+    std::make_heap(vecReady.begin(), vecReady.end(), comparer);
+
+    while (!vecReady.empty()) {
+        double dPriority = vecReady.front().get<0>();
+        CFeeRate feeRate = vecReady.front().get<1>();
+        const CTransaction& tx = *(vecReady.front().get<2>());
+        const uint256& hash = tx.GetHash();
+        std::pop_heap(vecReady.begin(), vecReady.end(), comparer);
+        vecReady.pop_back();
+
+        if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, tmpl.nHeight))
+            continue;
+
+        unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        if (tmpl.nBlockSize + nTxSize >= tmpl.nBlockMaxSize)
+            continue;
+
+        unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+        if (tmpl.nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            continue;
+
+        // Same rules for free transactions as when picking from scratch:
+        // they get in while there is room left in the priority part
+        bool fPriority = !tmpl.fSortedByFee && tmpl.nBlockSize + nTxSize < tmpl.nBlockPrioritySize && AllowFree(dPriority);
+        double dPriorityDelta = 0;
+        CAmount nFeeDelta = 0;
+        mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+        if (!fPriority && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (tmpl.nBlockSize + nTxSize >= tmpl.nBlockMinSize))
+            continue;
+
+        if (!ConnectToTemplate(tmpl, tx, nTxSize, nTxSigOps))
+            continue;
+
+        QueueReadyChildren(tmpl, hash, setDone, vecReady, comparer);
+    }
+}
+
+static void UpdateBlockTemplateCache(const CBlockIndex* pindexPrev, unsigned int nBlockMaxSize, unsigned int nBlockPrioritySize, unsigned int nBlockMinSize)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+    CBlockTemplateCache& tmpl = blockTemplateCache;
+
+    int64_t nTimeStart = GetTimeMicros();
+    int64_t nNow = GetTime();
+    bool fCurrent = tmpl.IsCurrent(pindexPrev, nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
+    unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    if (fCurrent && nTransactionsUpdated == tmpl.nTransactionsUpdated)
+        return;
+
+    size_t nTxBefore = tmpl.vtx.size();
+    int64_t nTimeFrom = tmpl.nTimeUpdated;
+    if (!fCurrent) {
+        tmpl.Clear();
+        tmpl.hashPrevBlock = pindexPrev->GetBlockHash();
+        tmpl.nHeight = pindexPrev->nHeight + 1;
+        tmpl.nBlockMaxSize = nBlockMaxSize;
+        tmpl.nBlockPrioritySize = nBlockPrioritySize;
+        tmpl.nBlockMinSize = nBlockMinSize;
+        tmpl.nTimeCreated = nNow;
+        tmpl.nTransactionsChanged = mempool.GetTransactionsChanged();
+        tmpl.pview = new CCoinsViewCache(pcoinsTip);
+    }
+    tmpl.nTimeUpdated = nNow;
+    tmpl.nTransactionsUpdated = nTransactionsUpdated;
+
+    if (fCurrent)
+        ExtendTemplateTransactions(tmpl, nTimeFrom);
+    else
+        CreateTemplateTransactions(tmpl);
+
+    LogPrint("bench", "    - Block template %s: %u of %u mempool transactions, +%u: %.2fms\n",
+        fCurrent ? "extended" : "created", tmpl.vtx.size(), mempool.mapTx.size(), tmpl.vtx.size() - (fCurrent ? nTxBefore : 0),
+        0.001 * (GetTimeMicros() - nTimeStart));
+}
+
+void InvalidateBlockTemplate()
+{
+    LOCK2(cs_main, mempool.cs);
+    blockTemplateCache.Clear();
+}
+
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
@@ -166,171 +489,16 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 
         CBlockIndex* pindexPrev = chainActive.Tip();
         const int nHeight = pindexPrev->nHeight + 1;
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
 
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
-
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                BOOST_FOREACH (COrphan* porphan, mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        // Mempool transactions, picked again or brought up to date
+        UpdateBlockTemplateCache(pindexPrev, nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
+        const CBlockTemplateCache& tmpl = blockTemplateCache;
+        pblock->vtx.insert(pblock->vtx.end(), tmpl.vtx.begin(), tmpl.vtx.end());
+        pblocktemplate->vTxFees.insert(pblocktemplate->vTxFees.end(), tmpl.vTxFees.begin(), tmpl.vTxFees.end());
+        pblocktemplate->vTxSigOps.insert(pblocktemplate->vTxSigOps.end(), tmpl.vTxSigOps.begin(), tmpl.vTxSigOps.end());
+        uint64_t nBlockSize = tmpl.nBlockSize;
+        uint64_t nBlockTx = tmpl.vtx.size();
+        nFees = tmpl.nFees;
 
         if (!fProofOfStake) {
             //Masternode and pow payments
@@ -365,6 +533,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         CValidationState state;
         if (!TestBlockValidity(state, *pblock, pindexPrev, false, false)) {
             LogPrintf("CreateNewBlock() : TestBlockValidity failed\n");
+            blockTemplateCache.Clear();
             return NULL;
         }
     }
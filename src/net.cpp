@@ -27,6 +27,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -367,6 +371,30 @@ CNode* FindNode(const CService& addr)
     return NULL;
 }
 
+#ifdef USE_EPOLL
+//! epoll instance of the socket handler, guarded by cs_vNodes; -1 when not in use
+static int hEpoll = -1;
+
+//! Listen sockets are tagged with an odd value in epoll_event.data, nodes with their (aligned) pointer
+static inline uint64_t EpollListenTag(size_t nIndex) { return ((uint64_t)nIndex << 1) | 1; }
+
+// requires LOCK(cs_vNodes)
+static void RegisterNodeSocket(CNode* pnode)
+{
+    if (hEpoll == -1 || pnode->hSocket == INVALID_SOCKET)
+        return;
+    // Edge triggered: the handler remembers readiness in fPendingRecv/fPendingSend until it
+    // hits EWOULDBLOCK, so interest never has to be changed while the node is connected.
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = (uint64_t)(uintptr_t)pnode;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) == -1)
+        LogPrint("net", "epoll_ctl add for peer=%d failed: %s\n", pnode->id, NetworkErrorString(errno));
+}
+#else
+static inline void RegisterNodeSocket(CNode* pnode) {}
+#endif
+
 CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMaster)
 {
     if (pszDest == NULL) {
@@ -409,6 +437,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
 
         {
             LOCK(cs_vNodes);
+            RegisterNodeSocket(pnode);
             vNodes.push_back(pnode);
         }
 
@@ -691,105 +720,494 @@ void SocketSendData(CNode* pnode)
 
 static list<CNode*> vNodesDisconnected;
 
-void ThreadSocketHandler()
+static void DisconnectNodes(std::set<CNode*>* psetReady = NULL)
 {
+    {
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                if (psetReady)
+                    psetReady->erase(pnode);
+
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
+
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
+
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
+            }
+        }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend) {
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv) {
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
+                        }
+                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    delete pnode;
+                }
+            }
+        }
+    }
+}
+
+static void NotifyNumConnectionsChanged(unsigned int& nPrevNodeCount)
+{
+    if (vNodes.size() != nPrevNodeCount) {
+        nPrevNodeCount = vNodes.size();
+        uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+static void AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+    } else if (!IsSelectableSocket(hSocket)) {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (CNode::IsBanned(addr) && !whitelisted) {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+
+        {
+            LOCK(cs_vNodes);
+            RegisterNodeSocket(pnode);
+            vNodes.push_back(pnode);
+        }
+    }
+}
+
+/**
+ * Read once from the socket into the node's receive buffer.
+ * Returns the number of bytes read, 0 if the socket would block, or -1 if the
+ * connection was closed or failed.
+ */
+// requires LOCK(cs_vRecvMsg)
+static int SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0) {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return nBytes;
+    } else if (nBytes == 0) {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    } else {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr == WSAEWOULDBLOCK || nErr == WSAEMSGSIZE || nErr == WSAEINTR || nErr == WSAEINPROGRESS)
+            return 0;
+        if (!pnode->fDisconnect)
+            LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+        pnode->CloseSocketDisconnect();
+    }
+    return -1;
+}
+
+// requires LOCK(cs_vRecvMsg)
+static bool ReceiveBufferFull(CNode* pnode)
+{
+    return !pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() &&
+           pnode->GetTotalRecvSize() > ReceiveFloodSize();
+}
+
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+/** Closes the handler's epoll instance however the loop is left */
+class CEpollHolder
+{
+public:
+    CEpollHolder(int hEpollIn)
+    {
+        LOCK(cs_vNodes);
+        hEpoll = hEpollIn;
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            RegisterNodeSocket(pnode);
+    }
+    ~CEpollHolder()
+    {
+        LOCK(cs_vNodes);
+        close(hEpoll);
+        hEpoll = -1;
+    }
+};
+
+/**
+ * Event driven socket handler. Sockets are registered once; readiness
+ * reported by epoll is kept on the node until it has been used up, and only
+ * nodes with outstanding readiness are visited. Returns false if epoll isn't
+ * available, so the caller can fall back to polling.
+ */
+static bool ThreadSocketHandlerEpoll()
+{
+    int hEpollNew = epoll_create1(EPOLL_CLOEXEC);
+    if (hEpollNew == -1) {
+        LogPrintf("epoll_create1 failed: %s, falling back to poll()\n", NetworkErrorString(errno));
+        return false;
+    }
+    CEpollHolder holder(hEpollNew);
+
+    for (size_t i = 0; i < vhListenSocket.size(); i++) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = EpollListenTag(i);
+        if (epoll_ctl(hEpollNew, EPOLL_CTL_ADD, vhListenSocket[i].socket, &event) == -1)
+            LogPrintf("epoll_ctl add for listen socket failed: %s\n", NetworkErrorString(errno));
+    }
+
     unsigned int nPrevNodeCount = 0;
+    std::set<CNode*> setReady;
+    std::vector<struct epoll_event> vEvents(256);
+    int64_t nLastDisconnectCheck = 0;
+    int64_t nLastInactivityCheck = 0;
+    bool fProgress = false;
     while (true) {
         //
-        // Disconnect nodes
+        // Housekeeping: disconnects every 50ms, timeouts every second
         //
-        {
+        int64_t nNow = GetTimeMillis();
+        if (nNow - nLastDisconnectCheck >= 50) {
+            nLastDisconnectCheck = nNow;
+            DisconnectNodes(&setReady);
+            NotifyNumConnectionsChanged(nPrevNodeCount);
+
+            bool fInactivityCheck = nNow - nLastInactivityCheck >= 1000;
+            if (fInactivityCheck)
+                nLastInactivityCheck = nNow;
             LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH (CNode* pnode, vNodesCopy) {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
-
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+            BOOST_FOREACH (CNode* pnode, vNodes) {
+                if (fInactivityCheck)
+                    InactivityCheck(pnode);
+                // Retry queued data whose optimistic write from another thread was interrupted
+                // before filling the socket buffer; those would not get a new EPOLLOUT edge.
+                if (!pnode->fPendingSend && pnode->nSendSize > 0) {
+                    pnode->fPendingSend = true;
+                    setReady.insert(pnode);
+                }
+            }
+        }
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+        //
+        // Wait for new events; don't block while ready nodes can make progress
+        //
+        int nTimeout = (fProgress && !setReady.empty()) ? 0 : 50;
+        int nEvents = epoll_wait(hEpollNew, &vEvents[0], vEvents.size(), nTimeout);
+        boost::this_thread::interruption_point();
+        if (nEvents == -1) {
+            if (errno != EINTR) {
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+                MilliSleep(nTimeout);
+            }
+            nEvents = 0;
+        }
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+        for (int i = 0; i < nEvents; i++) {
+            const struct epoll_event& event = vEvents[i];
+            if (event.data.u64 & 1) {
+                //
+                // Accept new connections
+                //
+                AcceptConnection(vhListenSocket[event.data.u64 >> 1]);
+                continue;
             }
+            CNode* pnode = (CNode*)(uintptr_t)event.data.u64;
+            if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                pnode->fPendingRecv = true;
+            if (event.events & EPOLLOUT)
+                pnode->fPendingSend = true;
+            setReady.insert(pnode);
         }
+        if (nEvents == (int)vEvents.size())
+            vEvents.resize(vEvents.size() * 2);
+
+        //
+        // Service ready sockets
+        //
+        fProgress = false;
+        vector<CNode*> vNodesCopy(setReady.begin(), setReady.end());
         {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend) {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv) {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
-                        }
-                    }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
+            LOCK(cs_vNodes);
+            BOOST_FOREACH (CNode* pnode, vNodesCopy)
+                pnode->AddRef();
+        }
+        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+            boost::this_thread::interruption_point();
+            if (pnode->hSocket == INVALID_SOCKET) {
+                pnode->fPendingRecv = pnode->fPendingSend = false;
+                setReady.erase(pnode);
+                continue;
+            }
+
+            //
+            // Send
+            //
+            bool fSendQueued = false;
+            {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend) {
+                    if (pnode->fPendingSend && !pnode->vSendMsg.empty()) {
+                        size_t nSendSize = pnode->nSendSize;
+                        size_t nSendOffset = pnode->nSendOffset;
+                        SocketSendData(pnode);
+                        fProgress |= pnode->nSendSize != nSendSize || pnode->nSendOffset != nSendOffset;
                     }
+                    // Either everything went out, or the socket buffer is full and
+                    // epoll reports EPOLLOUT again once it drains.
+                    pnode->fPendingSend = false;
+                    fSendQueued = !pnode->vSendMsg.empty();
                 }
             }
+
+            //
+            // Receive, unless our data to this peer is stuck (see the poll loop below)
+            //
+            if (pnode->fPendingRecv && !fSendQueued && pnode->hSocket != INVALID_SOCKET) {
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (lockRecv && !ReceiveBufferFull(pnode)) {
+                    int nBytes = SocketRecvData(pnode);
+                    if (nBytes > 0)
+                        fProgress = true;
+                    else
+                        pnode->fPendingRecv = false;
+                }
+            }
+
+            if (!pnode->fPendingRecv && !pnode->fPendingSend)
+                setReady.erase(pnode);
         }
-        if (vNodes.size() != nPrevNodeCount) {
-            nPrevNodeCount = vNodes.size();
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH (CNode* pnode, vNodesCopy)
+                pnode->Release();
         }
+    }
+    return true;
+}
+#endif
+
+#ifdef USE_POLL
+static void SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    std::map<SOCKET, struct pollfd> mapPollFds;
+    BOOST_FOREACH (SOCKET hSocket, recv_set) {
+        mapPollFds[hSocket].fd = hSocket;
+        mapPollFds[hSocket].events |= POLLIN;
+    }
+    BOOST_FOREACH (SOCKET hSocket, send_set) {
+        mapPollFds[hSocket].fd = hSocket;
+        mapPollFds[hSocket].events |= POLLOUT;
+    }
+    BOOST_FOREACH (SOCKET hSocket, error_set)
+        mapPollFds[hSocket].fd = hSocket;
+
+    std::vector<struct pollfd> vPollFds;
+    vPollFds.reserve(mapPollFds.size());
+    for (std::map<SOCKET, struct pollfd>::const_iterator it = mapPollFds.begin(); it != mapPollFds.end(); ++it)
+        vPollFds.push_back(it->second);
+
+    recv_set.clear();
+    send_set.clear();
+    error_set.clear();
+
+    // frequency to poll pnode->vSend
+    int nPoll = poll(vPollFds.empty() ? NULL : &vPollFds[0], vPollFds.size(), 50);
+    boost::this_thread::interruption_point();
+    if (nPoll == SOCKET_ERROR) {
+        LogPrintf("socket poll error %s\n", NetworkErrorString(WSAGetLastError()));
+        MilliSleep(50);
+        return;
+    }
+
+    BOOST_FOREACH (const struct pollfd& pollFd, vPollFds) {
+        if (pollFd.revents & (POLLIN | POLLHUP))
+            recv_set.insert(pollFd.fd);
+        if (pollFd.revents & POLLOUT)
+            send_set.insert(pollFd.fd);
+        if (pollFd.revents & (POLLERR | POLLNVAL))
+            error_set.insert(pollFd.fd);
+    }
+}
+#else
+static void SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+
+    BOOST_FOREACH (SOCKET hSocket, recv_set) {
+        FD_SET(hSocket, &fdsetRecv);
+        hSocketMax = max(hSocketMax, hSocket);
+    }
+    BOOST_FOREACH (SOCKET hSocket, send_set) {
+        FD_SET(hSocket, &fdsetSend);
+        hSocketMax = max(hSocketMax, hSocket);
+    }
+    BOOST_FOREACH (SOCKET hSocket, error_set) {
+        FD_SET(hSocket, &fdsetError);
+        hSocketMax = max(hSocketMax, hSocket);
+    }
+    bool have_fds = !recv_set.empty() || !send_set.empty() || !error_set.empty();
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+        &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    boost::this_thread::interruption_point();
+
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            // report all sockets readable, so errors are picked up by recv()
+            send_set.clear();
+            error_set.clear();
+        }
+        MilliSleep(timeout.tv_usec / 1000);
+        return;
+    }
+
+    std::set<SOCKET> all;
+    all.insert(recv_set.begin(), recv_set.end());
+    all.insert(send_set.begin(), send_set.end());
+    all.insert(error_set.begin(), error_set.end());
+    recv_set.clear();
+    send_set.clear();
+    error_set.clear();
+    BOOST_FOREACH (SOCKET hSocket, all) {
+        if (FD_ISSET(hSocket, &fdsetRecv))
+            recv_set.insert(hSocket);
+        if (FD_ISSET(hSocket, &fdsetSend))
+            send_set.insert(hSocket);
+        if (FD_ISSET(hSocket, &fdsetError))
+            error_set.insert(hSocket);
+    }
+}
+#endif
+
+void ThreadSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (ThreadSocketHandlerEpoll())
+        return;
+#endif
+
+    unsigned int nPrevNodeCount = 0;
+    while (true) {
+        //
+        // Disconnect nodes
+        //
+        DisconnectNodes();
+        NotifyNumConnectionsChanged(nPrevNodeCount);
 
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+        std::set<SOCKET> recv_set;
+        std::set<SOCKET> send_set;
+        std::set<SOCKET> error_set;
 
-        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
+        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket)
+            recv_set.insert(hListenSocket.socket);
 
         {
             LOCK(cs_vNodes);
             BOOST_FOREACH (CNode* pnode, vNodes) {
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
+                error_set.insert(pnode->hSocket);
 
                 // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
+                // * If there is data to send, wait for sending data. As this only
                 //   happens when optimistic write failed, we choose to first drain the
                 //   write buffer in this case before receiving more. This avoids
                 //   needlessly queueing received data, if the remote peer is not themselves
                 //   receiving data. This means properly utilizing TCP flow control signalling.
                 // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
+                //   or there is space left in the buffer, wait for receiving data.
                 // * (if neither of the above applies, there is certainly one message
                 //   in the receiver buffer ready to be processed).
                 // Together, that means that at least one of the following is always possible,
@@ -800,82 +1218,26 @@ void ThreadSocketHandler()
                 {
                     TRY_LOCK(pnode->cs_vSend, lockSend);
                     if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
+                        send_set.insert(pnode->hSocket);
                         continue;
                     }
                 }
                 {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
+                    if (lockRecv && !ReceiveBufferFull(pnode))
+                        recv_set.insert(pnode->hSocket);
                 }
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-            &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
-
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec / 1000);
-        }
+        SocketEvents(recv_set, send_set, error_set);
 
         //
         // Accept new connections
         //
         BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
-
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
-
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH (CNode* pnode, vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
-
-                if (hSocket == INVALID_SOCKET) {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                } else if (!IsSelectableSocket(hSocket)) {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (CNode::IsBanned(addr) && !whitelisted) {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
-
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
-            }
+            if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket))
+                AcceptConnection(hListenSocket);
         }
 
         //
@@ -896,35 +1258,10 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
+            if (recv_set.count(pnode->hSocket) || error_set.count(pnode->hSocket)) {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        } else if (nBytes == 0) {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        } else if (nBytes < 0) {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+                if (lockRecv)
+                    SocketRecvData(pnode);
             }
 
             //
@@ -932,7 +1269,7 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend)) {
+            if (send_set.count(pnode->hSocket)) {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
                     SocketSendData(pnode);
@@ -941,22 +1278,7 @@ void ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -1918,6 +2240,8 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    fPendingRecv = false;
+    fPendingSend = false;
     hashContinue = 0;
     nStartingHeight = -1;
     fGetAddr = false;
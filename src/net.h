@@ -224,6 +224,9 @@ public:
     uint64_t nSendBytes;
     std::deque<CSerializeData> vSendMsg;
     CCriticalSection cs_vSend;
+    // Socket readiness reported by epoll and not used up yet (socket handler thread only)
+    bool fPendingRecv;
+    bool fPendingSend;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
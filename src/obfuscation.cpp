@@ -9,6 +9,7 @@
 #include "init.h"
 #include "main.h"
 #include "masternodeman.h"
+#include "script/sigcache.h"
 #include "script/sign.h"
 #include "swifttx.h"
 #include "ui_interface.h"
@@ -2161,22 +2162,40 @@ bool CObfuScationSigner::SignMessage(std::string strMessage, std::string& errorM
     return true;
 }
 
-bool CObfuScationSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage)
+bool CObfuScationSigner::VerifyMessage(CPubKey pubkey, vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage, bool fLog)
 {
     CHashWriter ss(SER_GETHASH, 0);
     ss << strMessageMagic;
     ss << strMessage;
+    uint256 hash = ss.GetHash();
+
+    // Gossip is relayed by every peer, and may have been checked ahead by PreverifyQueuedMasternodeMessages
+    if (IsMessageSignatureCached(hash, vchSig, pubkey))
+        return true;
 
     CPubKey pubkey2;
-    if (!pubkey2.RecoverCompact(ss.GetHash(), vchSig)) {
+    if (!pubkey2.RecoverCompact(hash, vchSig)) {
         errorMessage = _("Error recovering public key.");
         return false;
     }
 
-    if (fDebug && pubkey2.GetID() != pubkey.GetID())
+    if (fLog && fDebug && pubkey2.GetID() != pubkey.GetID())
         LogPrintf("CObfuScationSigner::VerifyMessage -- keys don't match: %s %s\n", pubkey2.GetID().ToString(), pubkey.GetID().ToString());
 
-    return (pubkey2.GetID() == pubkey.GetID());
+    if (pubkey2.GetID() != pubkey.GetID())
+        return false;
+
+    AddMessageSignatureToCache(hash, vchSig, pubkey);
+    return true;
+}
+
+bool CMessageSignatureCheck::operator()()
+{
+    std::string errorMessage;
+    obfuScationSigner.VerifyMessage(pubkey, vchSig, strMessage, errorMessage, false);
+    // A bad signature must not stop the rest of the batch from being checked; the
+    // serial check of the message rejects it, and logs it
+    return true;
 }
 
 bool CObfuscationQueue::Sign()
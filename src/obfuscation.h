@@ -255,8 +255,31 @@ public:
     bool SetKey(std::string strSecret, std::string& errorMessage, CKey& key, CPubKey& pubkey);
     /// Sign the message, returns true if successful
     bool SignMessage(std::string strMessage, std::string& errorMessage, std::vector<unsigned char>& vchSig, CKey key);
-    /// Verify the message, returns true if succcessful
-    bool VerifyMessage(CPubKey pubkey, std::vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage);
+    /// Verify the message, returns true if succcessful; fLog=false leaves logging a mismatch to the caller
+    bool VerifyMessage(CPubKey pubkey, std::vector<unsigned char>& vchSig, std::string strMessage, std::string& errorMessage, bool fLog = true);
+};
+
+/** A message signature to be checked ahead of time on a CCheckQueue, filling the signature cache
+ */
+class CMessageSignatureCheck
+{
+private:
+    CPubKey pubkey;
+    std::vector<unsigned char> vchSig;
+    std::string strMessage;
+
+public:
+    CMessageSignatureCheck() {}
+    CMessageSignatureCheck(const CPubKey& pubkeyIn, const std::vector<unsigned char>& vchSigIn, const std::string& strMessageIn) : pubkey(pubkeyIn), vchSig(vchSigIn), strMessage(strMessageIn) {}
+
+    bool operator()();
+
+    void swap(CMessageSignatureCheck& check)
+    {
+        std::swap(pubkey, check.pubkey);
+        vchSig.swap(check.vchSig);
+        strMessage.swap(check.strMessage);
+    }
 };
 
 /** Used to keep track of current status of Obfuscation pool
@@ -0,0 +1,237 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_POOLALLOC_H
+#define BITCOIN_POOLALLOC_H
+
+#include <stdlib.h>
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Arena for many small allocations of a few sizes, like the nodes of a
+ * node-based container. Blocks are carved out of large chunks, and freed
+ * blocks go on a free list per size so they are reused without going through
+ * malloc. Chunks are only given back to the system by Release() or on
+ * destruction, which free everything at once.
+ *
+ * Requests larger than MAX_BLOCK_SIZE (like hash table bucket arrays) are
+ * passed through to operator new. Not thread-safe: the owner of the container
+ * using it provides the locking.
+ */
+class CPoolResource
+{
+public:
+    static const size_t BLOCK_ALIGN = sizeof(void*);
+    static const size_t MAX_BLOCK_SIZE = 256;
+    static const size_t MIN_CHUNK_SIZE = 16 << 10;
+    static const size_t MAX_CHUNK_SIZE = 1 << 20;
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    std::vector<char*> vChunks;
+    FreeBlock* vFreeLists[MAX_BLOCK_SIZE / BLOCK_ALIGN + 1];
+    char* pChunkPos;
+    char* pChunkEnd;
+    size_t nChunkBytes;
+    size_t nUsedBytes;    //! bytes handed out and not freed, pooled or not
+    size_t nLargeBytes;   //! bytes passed through to operator new and not freed
+
+    CPoolResource(const CPoolResource&);
+    CPoolResource& operator=(const CPoolResource&);
+
+    static size_t FreeListIndex(size_t bytes)
+    {
+        return (bytes + BLOCK_ALIGN - 1) / BLOCK_ALIGN;
+    }
+
+    static bool IsPooled(size_t bytes, size_t align)
+    {
+        return bytes > 0 && bytes <= MAX_BLOCK_SIZE && align <= BLOCK_ALIGN;
+    }
+
+    void AllocateChunk()
+    {
+        // Put what is left of the current chunk on its free list (it is
+        // smaller than the block that did not fit, so it has one)
+        size_t nLeft = pChunkEnd - pChunkPos;
+        if (nLeft >= BLOCK_ALIGN)
+            PushFree(pChunkPos, nLeft / BLOCK_ALIGN);
+        // Grow geometrically so small pools (like a per-block view) stay small
+        size_t nChunkSize = nChunkBytes;
+        if (nChunkSize < MIN_CHUNK_SIZE)
+            nChunkSize = MIN_CHUNK_SIZE;
+        if (nChunkSize > MAX_CHUNK_SIZE)
+            nChunkSize = MAX_CHUNK_SIZE;
+        char* pChunk = static_cast<char*>(::operator new(nChunkSize));
+        vChunks.push_back(pChunk);
+        pChunkPos = pChunk;
+        pChunkEnd = pChunk + nChunkSize;
+        nChunkBytes += nChunkSize;
+    }
+
+    void PushFree(void* p, size_t nIndex)
+    {
+        FreeBlock* pBlock = static_cast<FreeBlock*>(p);
+        pBlock->next = vFreeLists[nIndex];
+        vFreeLists[nIndex] = pBlock;
+    }
+
+    void Init()
+    {
+        for (size_t i = 0; i < sizeof(vFreeLists) / sizeof(vFreeLists[0]); i++)
+            vFreeLists[i] = NULL;
+        pChunkPos = pChunkEnd = NULL;
+        nChunkBytes = 0;
+        nUsedBytes = 0;
+        nLargeBytes = 0;
+    }
+
+public:
+    CPoolResource() { Init(); }
+
+    ~CPoolResource() { Release(); }
+
+    void* Allocate(size_t bytes, size_t align)
+    {
+        if (!IsPooled(bytes, align)) {
+            void* p = ::operator new(bytes);
+            nUsedBytes += bytes;
+            nLargeBytes += bytes;
+            return p;
+        }
+        size_t nIndex = FreeListIndex(bytes);
+        nUsedBytes += nIndex * BLOCK_ALIGN;
+        if (vFreeLists[nIndex] != NULL) {
+            FreeBlock* pBlock = vFreeLists[nIndex];
+            vFreeLists[nIndex] = pBlock->next;
+            return pBlock;
+        }
+        if ((size_t)(pChunkEnd - pChunkPos) < nIndex * BLOCK_ALIGN)
+            AllocateChunk();
+        void* p = pChunkPos;
+        pChunkPos += nIndex * BLOCK_ALIGN;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t bytes, size_t align)
+    {
+        if (!IsPooled(bytes, align)) {
+            nUsedBytes -= bytes;
+            nLargeBytes -= bytes;
+            ::operator delete(p);
+            return;
+        }
+        size_t nIndex = FreeListIndex(bytes);
+        nUsedBytes -= nIndex * BLOCK_ALIGN;
+        PushFree(p, nIndex);
+    }
+
+    /**
+     * Give all chunks back to the system. Everything allocated from the pool
+     * must have been freed (or be abandoned) by then.
+     */
+    void Release()
+    {
+        for (size_t i = 0; i < vChunks.size(); i++)
+            ::operator delete(vChunks[i]);
+        std::vector<char*>().swap(vChunks);
+        Init();
+    }
+
+    //! Bytes currently allocated through the pool
+    size_t UsedBytes() const { return nUsedBytes; }
+
+    //! Bytes held from the system: all chunks plus the passed-through allocations
+    size_t TotalBytes() const { return nChunkBytes + nLargeBytes; }
+};
+
+/**
+ * Allocator drawing from a CPoolResource. A default constructed allocator has
+ * no pool and uses the heap, so containers that do not care can keep using the
+ * same type.
+ *
+ * It is stateful: two allocators are only equal if they share the pool, so it
+ * does not derive from std::allocator, whose traits say every instance is
+ * interchangeable. A container moved or swapped takes its pool along; a copy
+ * assigned keeps its own.
+ */
+template <typename T>
+struct pool_allocator {
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    typedef std::false_type is_always_equal;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <typename U>
+    struct rebind {
+        typedef pool_allocator<U> other;
+    };
+
+    CPoolResource* pool;
+
+    pool_allocator() throw() : pool(NULL) {}
+    explicit pool_allocator(CPoolResource* poolIn) throw() : pool(poolIn) {}
+    template <typename U>
+    pool_allocator(const pool_allocator<U>& a) throw() : pool(a.pool)
+    {
+    }
+
+    T* allocate(std::size_t n, const void* = 0)
+    {
+        if (pool == NULL)
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(pool->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (pool == NULL)
+            return ::operator delete(p);
+        pool->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    std::size_t max_size() const throw() { return std::size_t(-1) / sizeof(T); }
+
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new ((void*)p) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    void destroy(U* p)
+    {
+        p->~U();
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const pool_allocator<T>& a, const pool_allocator<U>& b)
+{
+    return a.pool == b.pool;
+}
+
+template <typename T, typename U>
+bool operator!=(const pool_allocator<T>& a, const pool_allocator<U>& b)
+{
+    return a.pool != b.pool;
+}
+
+#endif // BITCOIN_POOLALLOC_H
@@ -160,10 +160,11 @@ CTxOut getPrevOut(const COutPoint& out)
 
 void getNextIn(const COutPoint& Out, uint256& Hash, unsigned int& n)
 {
-    // Hash = 0;
-    // n = 0;
-    // if (paddressmap)
-    //    paddressmap->ReadNextIn(Out, Hash, n);
+    CSpentIndexValue spent;
+    if (GetSpentIndex(CSpentIndexKey(Out.hash, Out.n), spent)) {
+        Hash = spent.txid;
+        n = spent.index;
+    }
 }
 
 const CBlockIndex* getexplorerBlockIndex(int64_t height)
@@ -324,7 +325,7 @@ std::string TxToString(uint256 BlockHash, const CTransaction& tx)
         const CTxOut& Out = tx.vout[i];
         uint256 HashNext = uint256S("0");
         unsigned int nNext = 0;
-        bool fAddrIndex = false;
+        bool fAddrIndex = fAddressIndex;
         getNextIn(COutPoint(TxHash, i), HashNext, nNext);
         std::string OutputsContentCells[] =
             {
@@ -386,37 +387,37 @@ std::string AddressToString(const CBitcoinAddress& Address)
             _("Balance")};
     std::string TxContent = table + makeHTMLTableRow(TxLabels, sizeof(TxLabels) / sizeof(std::string));
 
-    std::set<COutPoint> PrevOuts;
-    /*
-    CScript AddressScript;
-    AddressScript.SetDestination(Address.Get());
-
-    CAmount Sum = 0;
-    bool fAddrIndex = false;
+    CScript AddressScript = GetScriptForDestination(Address.Get());
+    uint160 hashBytes;
+    int type = GetAddressIndexType(AddressScript, hashBytes);
 
-    if (!fAddrIndex)
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    if (!fAddressIndex || !GetAddressIndex(hashBytes, type, vAddressIndex))
         return ""; // it will take too long to find transactions by address
-    else
-    {
-        std::vector<CDiskTxPos> Txs;
-        paddressmap->GetTxs(Txs, AddressScript.GetID());
-        BOOST_FOREACH (const CDiskTxPos& pos, Txs)
-        {
-            CTransaction tx;
-            CBlock block;
-            uint256 bhash = block.GetHash();
-            GetTransaction(pos.nTxOffset, tx, bhash);
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
-            if (mi == mapBlockIndex.end())
-                continue;
-            CBlockIndex* pindex = (*mi).second;
-            if (!pindex || !chainActive.Contains(pindex))
-                continue;
-            std::string Prepend = "<a href=\"" + itostr(pindex->nHeight) + "\">" + TimeToString(pindex->nTime) + "</a>";
-            TxContent += TxToRow(tx, AddressScript, Prepend, &Sum);
-        }
+
+    std::vector<uint256> vTxHashes;
+    std::set<uint256> setSeen;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = vAddressIndex.begin(); it != vAddressIndex.end(); ++it)
+        if (setSeen.insert(it->first.txhash).second)
+            vTxHashes.push_back(it->first.txhash);
+    std::vector<CTransaction> vTx;
+    std::vector<uint256> vHashBlock;
+    GetTransactions(vTxHashes, vTx, vHashBlock, true);
+
+    CAmount Sum = 0;
+    for (size_t i = 0; i < vTx.size(); i++) {
+        const CTransaction& tx = vTx[i];
+        if (tx.IsNull())
+            continue;
+        BlockMap::iterator mi = mapBlockIndex.find(vHashBlock[i]);
+        if (mi == mapBlockIndex.end())
+            continue;
+        CBlockIndex* pindex = mi->second;
+        if (!pindex || !chainActive.Contains(pindex))
+            continue;
+        std::string Prepend = "<a href=\"" + itostr(pindex->nHeight) + "\">" + TimeToString(pindex->nTime) + "</a>";
+        TxContent += TxToRow(tx, AddressScript, Prepend, &Sum);
     }
-    */
     TxContent += "</table>";
 
     std::string Content;
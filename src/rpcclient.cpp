@@ -68,6 +68,11 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"addmultisigaddress", 1},
         {"createmultisig", 0},
         {"createmultisig", 1},
+        {"getaddressbalance", 0},
+        {"getaddressutxos", 0},
+        {"getaddresstxids", 0},
+        {"getaddresstxids", 1},
+        {"getaddresstxids", 2},
         {"listunspent", 0},
         {"listunspent", 1},
         {"listunspent", 2},
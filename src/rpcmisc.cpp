@@ -481,6 +481,156 @@ Value setmocktime(const Array& params, bool fHelp)
     return Value::null;
 }
 
+static void ParseIndexAddresses(const Value& value, std::vector<std::pair<uint160, int> >& vAddresses)
+{
+    Array addresses = value.get_array();
+    BOOST_FOREACH (const Value& addr, addresses) {
+        CBitcoinAddress address(addr.get_str());
+        if (!address.IsValid())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, string("Invalid mktcoin address: ") + addr.get_str());
+        uint160 hashBytes;
+        int type = GetAddressIndexType(GetScriptForDestination(address.Get()), hashBytes);
+        vAddresses.push_back(std::make_pair(hashBytes, type));
+    }
+}
+
+static string IndexAddressToString(const uint160& hashBytes, int type)
+{
+    if (type == ADDRESS_INDEX_SCRIPT)
+        return CBitcoinAddress(CScriptID(hashBytes)).ToString();
+    return CBitcoinAddress(CKeyID(hashBytes)).ToString();
+}
+
+Value getaddressbalance(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance [\"address\",...]\n"
+            "\nReturns the balance of the given addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"addresses\"   (string, required) A json array of mktcoin addresses\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\" : x.xxx,    (numeric) The current balance in MLM\n"
+            "  \"received\" : x.xxx,   (numeric) The total amount received in MLM, including change\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getaddressbalance", "\"[\\\"mabbh4fFALTvXoeuCUJSpNisGjF8eFHd2Y\\\"]\"") + HelpExampleRpc("getaddressbalance", "[\"mabbh4fFALTvXoeuCUJSpNisGjF8eFHd2Y\"]"));
+
+    std::vector<std::pair<uint160, int> > vAddresses;
+    ParseIndexAddresses(params[0], vAddresses);
+
+    CAmount nBalance = 0;
+    CAmount nReceived = 0;
+    for (std::vector<std::pair<uint160, int> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); ++it) {
+        std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+        if (!GetAddressIndex(it->first, it->second, vAddressIndex))
+            throw JSONRPCError(RPC_MISC_ERROR, "No information available for address (is -addressindex enabled?)");
+        for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator itIndex = vAddressIndex.begin(); itIndex != vAddressIndex.end(); ++itIndex) {
+            nBalance += itIndex->second;
+            if (itIndex->second > 0)
+                nReceived += itIndex->second;
+        }
+    }
+
+    Object result;
+    result.push_back(Pair("balance", ValueFromAmount(nBalance)));
+    result.push_back(Pair("received", ValueFromAmount(nReceived)));
+    return result;
+}
+
+Value getaddressutxos(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos [\"address\",...]\n"
+            "\nReturns the unspent outputs of the given addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"addresses\"   (string, required) A json array of mktcoin addresses\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\" : \"address\",  (string) The address\n"
+            "    \"txid\" : \"txid\",        (string) The transaction id\n"
+            "    \"outputIndex\" : n,      (numeric) The output index\n"
+            "    \"script\" : \"hex\",       (string) The script hex\n"
+            "    \"amount\" : x.xxx,       (numeric) The output amount in MLM\n"
+            "    \"height\" : n            (numeric) The block height of the output\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getaddressutxos", "\"[\\\"mabbh4fFALTvXoeuCUJSpNisGjF8eFHd2Y\\\"]\"") + HelpExampleRpc("getaddressutxos", "[\"mabbh4fFALTvXoeuCUJSpNisGjF8eFHd2Y\"]"));
+
+    std::vector<std::pair<uint160, int> > vAddresses;
+    ParseIndexAddresses(params[0], vAddresses);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    for (std::vector<std::pair<uint160, int> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); ++it) {
+        if (!GetAddressUnspent(it->first, it->second, vUnspent))
+            throw JSONRPCError(RPC_MISC_ERROR, "No information available for address (is -addressindex enabled?)");
+    }
+
+    Array result;
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = vUnspent.begin(); it != vUnspent.end(); ++it) {
+        Object output;
+        output.push_back(Pair("address", IndexAddressToString(it->first.hashBytes, it->first.type)));
+        output.push_back(Pair("txid", it->first.txhash.GetHex()));
+        output.push_back(Pair("outputIndex", (int)it->first.index));
+        output.push_back(Pair("script", HexStr(it->second.script.begin(), it->second.script.end())));
+        output.push_back(Pair("amount", ValueFromAmount(it->second.nValue)));
+        output.push_back(Pair("height", it->second.nHeight));
+        result.push_back(output);
+    }
+    return result;
+}
+
+Value getaddresstxids(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddresstxids [\"address\",...] ( start end )\n"
+            "\nReturns the txids touching the given addresses, in block order (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"addresses\"   (string, required) A json array of mktcoin addresses\n"
+            "2. start         (numeric, optional) The first block height to include\n"
+            "3. end           (numeric, optional) The last block height to include\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"txid\"   (string) The transaction id\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getaddresstxids", "\"[\\\"mabbh4fFALTvXoeuCUJSpNisGjF8eFHd2Y\\\"]\" 1000 2000") + HelpExampleRpc("getaddresstxids", "[\"mabbh4fFALTvXoeuCUJSpNisGjF8eFHd2Y\"], 1000, 2000"));
+
+    std::vector<std::pair<uint160, int> > vAddresses;
+    ParseIndexAddresses(params[0], vAddresses);
+
+    int nStart = 0;
+    int nEnd = 0;
+    if (params.size() > 1)
+        nStart = params[1].get_int();
+    if (params.size() > 2)
+        nEnd = params[2].get_int();
+    if (nStart < 0 || nEnd < 0 || (nEnd > 0 && nEnd < nStart))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid start or end height");
+
+    // Sorted by height, then txid so that the same tx touching several addresses is listed once
+    std::set<std::pair<int, uint256> > setTxids;
+    for (std::vector<std::pair<uint160, int> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); ++it) {
+        std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+        if (!GetAddressIndex(it->first, it->second, vAddressIndex, nStart, nEnd))
+            throw JSONRPCError(RPC_MISC_ERROR, "No information available for address (is -addressindex enabled?)");
+        for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator itIndex = vAddressIndex.begin(); itIndex != vAddressIndex.end(); ++itIndex)
+            setTxids.insert(std::make_pair(itIndex->first.nHeight, itIndex->first.txhash));
+    }
+
+    Array result;
+    for (std::set<std::pair<int, uint256> >::const_iterator it = setTxids.begin(); it != setTxids.end(); ++it)
+        result.push_back(it->second.GetHex());
+    return result;
+}
+
 #ifdef ENABLE_WALLET
 Value getstakingstatus(const Array& params, bool fHelp)
 {
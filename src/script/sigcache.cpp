@@ -5,13 +5,17 @@
 
 #include "sigcache.h"
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <atomic>
+#include <memory>
+
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
 namespace {
 
@@ -19,65 +23,157 @@ namespace {
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * Entries are the salted SHA256 of (signature hash, signature, public key),
+ * stored in a fixed table of small buckets. Lookups don't take a lock; an
+ * insert locks one of a few mutexes striped over the buckets and, when the
+ * bucket is full, overwrites the slot picked by the (unpredictable) entry.
  */
 class CSignatureCache
 {
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    static const unsigned int BUCKET_ENTRIES = 8;
+    static const unsigned int LOCK_STRIPES = 64;
+
+    //! An entry is four words; word 0 is zero while the slot is empty or being written
+    struct Entry {
+        std::atomic<uint64_t> words[4];
+    };
+    typedef uint64_t key_type[4];
+
+    uint256 nonce;
+    std::unique_ptr<Entry[]> table;
+    size_t nBuckets;
+    boost::mutex csStripes[LOCK_STRIPES];
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+    void ComputeKey(key_type& key, const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey) const
+    {
+        // The length prefix keeps (pubkey, sig) pairs from shifting bytes between the two
+        unsigned char out[CSHA256::OUTPUT_SIZE];
+        unsigned char nPubKeyLen = pubKey.size();
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&nPubKeyLen, 1).Write(pubKey.begin(), pubKey.size()).Write(vchSig.data(), vchSig.size()).Finalize(out);
+        for (int i = 0; i < 4; i++)
+            key[i] = ReadLE64(out + 8 * i);
+        // Zero marks an empty slot
+        if (key[0] == 0)
+            key[0] = 1;
+    }
+
+    bool Contains(const key_type& key) const
+    {
+        const Entry* bucket = &table[(key[0] % nBuckets) * BUCKET_ENTRIES];
+        for (unsigned int i = 0; i < BUCKET_ENTRIES; i++) {
+            const Entry& entry = bucket[i];
+            if (entry.words[0].load(std::memory_order_acquire) != key[0])
+                continue;
+            if (entry.words[1].load(std::memory_order_relaxed) == key[1] &&
+                entry.words[2].load(std::memory_order_relaxed) == key[2] &&
+                entry.words[3].load(std::memory_order_relaxed) == key[3]) {
+                // A writer clears word 0 before touching the others
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (entry.words[0].load(std::memory_order_relaxed) == key[0])
+                    return true;
+            }
+        }
+        return false;
+    }
 
 public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    CSignatureCache() : nBuckets(0), nHits(0), nMisses(0) {}
+
+    void Setup(size_t nBytes)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        nonce = GetRandHash();
+        nBuckets = std::max<size_t>(1, nBytes / (BUCKET_ENTRIES * sizeof(Entry)));
+        table.reset(new Entry[nBuckets * BUCKET_ENTRIES]);
+        for (size_t i = 0; i < nBuckets * BUCKET_ENTRIES; i++)
+            for (int j = 0; j < 4; j++)
+                table[i].words[j].store(0, std::memory_order_relaxed);
+        LogPrintf("Using %zu MiB for the signature cache, able to store %zu entries\n",
+            (nBuckets * BUCKET_ENTRIES * sizeof(Entry)) >> 20, nBuckets * BUCKET_ENTRIES);
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
+    bool Get(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    {
+        if (!nBuckets)
+            return false;
+        key_type key;
+        ComputeKey(key, hash, vchSig, pubKey);
+        if (Contains(key)) {
+            nHits.fetch_add(1, std::memory_order_relaxed);
             return true;
+        }
+        nMisses.fetch_add(1, std::memory_order_relaxed);
         return false;
     }
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    void Set(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+        if (!nBuckets)
+            return;
+        key_type key;
+        ComputeKey(key, hash, vchSig, pubKey);
+
+        size_t nBucket = key[0] % nBuckets;
+        boost::lock_guard<boost::mutex> lock(csStripes[nBucket % LOCK_STRIPES]);
+        if (Contains(key))
+            return;
+
+        Entry* bucket = &table[nBucket * BUCKET_ENTRIES];
+        // Evict a random entry if the bucket is full. Random because that helps
+        // foil would-be DoS attackers who might try to pre-generate and re-use
+        // a set of valid signatures that map to the same bucket.
+        Entry* slot = &bucket[key[1] % BUCKET_ENTRIES];
+        for (unsigned int i = 0; i < BUCKET_ENTRIES; i++) {
+            if (bucket[i].words[0].load(std::memory_order_relaxed) == 0) {
+                slot = &bucket[i];
+                break;
+            }
         }
+        slot->words[0].store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int j = 1; j < 4; j++)
+            slot->words[j].store(key[j], std::memory_order_relaxed);
+        slot->words[0].store(key[0], std::memory_order_release);
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+    void GetStats(uint64_t& nHitsRet, uint64_t& nMissesRet) const
+    {
+        nHitsRet = nHits.load(std::memory_order_relaxed);
+        nMissesRet = nMisses.load(std::memory_order_relaxed);
     }
 };
 
+CSignatureCache signatureCache;
+
 }
 
-bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+void InitSignatureCache()
+{
+    int64_t nMaxCacheSize = std::min(std::max(GetArg("-sigcachemaxmb", DEFAULT_MAX_SIG_CACHE_SIZE), (int64_t)0), MAX_MAX_SIG_CACHE_SIZE);
+    if (nMaxCacheSize > 0)
+        signatureCache.Setup((size_t)nMaxCacheSize << 20);
+}
+
+void GetSignatureCacheStats(uint64_t& nHits, uint64_t& nMisses)
+{
+    signatureCache.GetStats(nHits, nMisses);
+}
+
+bool IsMessageSignatureCached(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
 {
-    static CSignatureCache signatureCache;
+    return signatureCache.Get(hash, vchSig, pubKey);
+}
 
+void AddMessageSignatureToCache(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+{
+    signatureCache.Set(hash, vchSig, pubKey);
+}
+
+bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
     if (signatureCache.Get(sighash, vchSig, pubkey))
         return true;
 
@@ -8,8 +8,13 @@
 
 #include "script/interpreter.h"
 
+#include <stdint.h>
 #include <vector>
 
+//! -sigcachemaxmb default and upper bound, in megabytes
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+
 class CPubKey;
 
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
@@ -23,4 +28,17 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Size the signature cache from -sigcachemaxmb; the cache stays disabled until called */
+void InitSignatureCache();
+/** Number of cache lookups that found / did not find the signature since startup */
+void GetSignatureCacheStats(uint64_t& nHits, uint64_t& nMisses);
+/**
+ * Whether a signature of a message hash (signed outside of any script, like the masternode
+ * messages) was found valid before. Message hashes are prefixed with their own magic string,
+ * so they share the cache with transaction signatures without clashing.
+ */
+bool IsMessageSignatureCached(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey);
+/** Remember a message signature that was found valid */
+void AddMessageSignatureToCache(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
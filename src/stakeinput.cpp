@@ -16,6 +16,14 @@ bool CPivStake::SetInput(CTransaction txPrev, unsigned int n)
     return true;
 }
 
+//Use block metadata already resolved by the wallet instead of looking it up again
+void CPivStake::SetCachedMetadata(CBlockIndex* pindexFromIn, uint64_t nStakeModifierIn)
+{
+    this->pindexFrom = pindexFromIn;
+    this->nCachedStakeModifier = nStakeModifierIn;
+    this->fCachedMetadata = true;
+}
+
 bool CPivStake::GetTxFrom(CTransaction& tx)
 {
     tx = txFrom;
@@ -70,6 +78,11 @@ bool CPivStake::CreateTxOuts(CWallet* pwallet, vector<CTxOut>& vout, CAmount nTo
 
 bool CPivStake::GetModifier(uint64_t& nStakeModifier)
 {
+    if (fCachedMetadata) {
+        nStakeModifier = nCachedStakeModifier;
+        return true;
+    }
+
     int nStakeModifierHeight = 0;
     int64_t nStakeModifierTime = 0;
     GetIndexFrom();
@@ -93,6 +106,9 @@ CDataStream CPivStake::GetUniqueness()
 //The block that the UTXO was added to the chain
 CBlockIndex* CPivStake::GetIndexFrom()
 {
+    if (fCachedMetadata)
+        return pindexFrom;
+
     uint256 hashBlock = 0;
     CTransaction tx;
     if (GetTransaction(txFrom.GetHash(), tx, hashBlock, true)) {
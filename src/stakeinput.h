@@ -36,13 +36,18 @@ class CPivStake : public CStakeInput
 private:
     CTransaction txFrom;
     unsigned int nPosition;
+    bool fCachedMetadata;
+    uint64_t nCachedStakeModifier;
 public:
     CPivStake()
     {
         this->pindexFrom = nullptr;
+        this->fCachedMetadata = false;
+        this->nCachedStakeModifier = 0;
     }
 
     bool SetInput(CTransaction txPrev, unsigned int n);
+    void SetCachedMetadata(CBlockIndex* pindexFromIn, uint64_t nStakeModifierIn);
 
     CBlockIndex* GetIndexFrom() override;
     bool GetTxFrom(CTransaction& tx) override;
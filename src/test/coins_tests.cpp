@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "blockprefetch.h"
 #include "coins.h"
 #include "random.h"
 #include "uint256.h"
@@ -58,6 +59,22 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += it->second.coins.DynamicMemoryUsage();
+        }
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -83,14 +100,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool partially_flushed = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<uint256, CCoins> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -115,6 +133,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 coins.nVersion = insecure_rand();
                 coins.vout.resize(1);
                 coins.vout[0].nValue = insecure_rand();
+                coins.vout[0].scriptPubKey.resize(insecure_rand() % 64);
                 *entry = coins;
             } else {
                 coins.Clear();
@@ -135,11 +154,19 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                     missed_an_entry = true;
                 }
             }
+            BOOST_FOREACH (const CCoinsViewCacheTest* test, stack) {
+                test->SelfTest();
+            }
         }
 
         if (insecure_rand() % 100 == 0) {
             // Every 100 iterations, change the cache stack.
-            if (stack.size() > 0 && insecure_rand() % 2 == 0) {
+            if (stack.size() > 0 && insecure_rand() % 4 == 0) {
+                // Write the tip through, keeping (some of) its entries.
+                BOOST_CHECK(stack.back()->PartialFlush(insecure_rand() % 2));
+                stack.back()->SelfTest();
+                partially_flushed = true;
+            } else if (stack.size() > 0 && insecure_rand() % 2 == 0) {
                 stack.back()->Flush();
                 delete stack.back();
                 stack.pop_back();
@@ -151,7 +178,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -173,6 +200,61 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(partially_flushed);
+}
+
+BOOST_AUTO_TEST_CASE(coins_prefetch_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewPrefetch prefetch(&base);
+    uint256 txid = GetRandHash();
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.vout.resize(1);
+    coins.vout[0].nValue = 1;
+
+    // Nothing to prefetch yet
+    std::vector<uint256> vTxid(1, txid);
+    prefetch.Prefetch(vTxid);
+    BOOST_CHECK(!prefetch.HaveCoins(txid));
+
+    {
+        CCoinsViewCache cache(&prefetch);
+        *cache.ModifyCoins(txid) = coins;
+        BOOST_CHECK(cache.Flush());
+    }
+    prefetch.Prefetch(vTxid);
+    BOOST_CHECK(prefetch.HaveCoins(txid));
+
+    // A write drops what was read ahead, so the cache sees the new version
+    {
+        CCoinsViewCache cache(&prefetch);
+        cache.ModifyCoins(txid)->vout[0].nValue = 2;
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoins result;
+    BOOST_CHECK(prefetch.GetCoins(txid, result));
+    BOOST_CHECK_EQUAL(result.vout[0].nValue, 2);
+
+    // Same while the entry read ahead is still held when the write lands
+    prefetch.Prefetch(vTxid);
+    BOOST_CHECK(prefetch.HaveCoins(txid));
+    {
+        CCoinsMap mapCoins;
+        CCoinsCacheEntry& entry = mapCoins[txid];
+        entry.coins = coins;
+        entry.coins.vout[0].nValue = 3;
+        entry.flags = CCoinsCacheEntry::DIRTY;
+        BOOST_CHECK(prefetch.BatchWrite(mapCoins, base.GetBestBlock()));
+    }
+    BOOST_CHECK(prefetch.GetCoins(txid, result));
+    BOOST_CHECK_EQUAL(result.vout[0].nValue, 3);
+
+    // A prefetched entry is handed out as is
+    prefetch.Prefetch(vTxid);
+    CCoinsViewCache cache(&prefetch);
+    const CCoins* pcoins = cache.AccessCoins(txid);
+    BOOST_CHECK(pcoins && pcoins->vout[0].nValue == 3);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,8 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/x17.h"
+#include "hash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 
@@ -131,6 +133,46 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d_oneblock) {
+    // The multi-lane double SHA256 must match CSHA256 for every length and lane remainder
+    for (size_t len = 0; len <= 55; len++) {
+        for (size_t n = 0; n <= 19; n++) {
+            std::vector<unsigned char> in(len * n + 1), out(32 * n + 1), ref(32 * n + 1);
+            for (size_t i = 0; i < in.size(); i++)
+                in[i] = insecure_rand();
+            SHA256DOneBlock(&out[0], &in[0], len, n);
+            for (size_t i = 0; i < n; i++) {
+                unsigned char buf[CSHA256::OUTPUT_SIZE];
+                CSHA256().Write(&in[i * len], len).Finalize(buf);
+                CSHA256().Write(buf, sizeof(buf)).Finalize(&ref[i * 32]);
+            }
+            BOOST_CHECK(out == ref);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(x17_testvectors) {
+    // Vectors from the original sph_* chain in HashX17, before the one-shot X17 engine
+    std::string fox = "The quick brown fox jumps over the lazy dog";
+    std::vector<unsigned char> zero(80, 0);
+    BOOST_CHECK_EQUAL(HashX17(zero.begin(), zero.begin()).GetHex(), "537920b6f5354b10a5adb27c070d38058b1bdce070de338cf5034d7c3f0c3696");
+    BOOST_CHECK_EQUAL(HashX17(zero.begin(), zero.end()).GetHex(), "1c88b270763e53f55141ca0dec53cf8afcb74360d93c2cd59c0ef9fb557af081");
+    BOOST_CHECK_EQUAL(HashX17(fox.begin(), fox.end()).GetHex(), "958399aafef85344daba789bd611b1bd143de215b358cfec64cadb5ba9727d1f");
+
+    // The multi-buffer API must match single hashes for every group remainder
+    for (size_t len = 0; len <= 160; len += 80) {
+        for (size_t n = 0; n <= 19; n++) {
+            std::vector<unsigned char> in(len * n + 1), out(X17_OUTPUT_SIZE * n + 1), ref(X17_OUTPUT_SIZE * n + 1);
+            for (size_t i = 0; i < in.size(); i++)
+                in[i] = insecure_rand();
+            X17HashMany(&out[0], &in[0], len, n);
+            for (size_t i = 0; i < n; i++)
+                X17Hash(&ref[i * X17_OUTPUT_SIZE], &in[i * len], len);
+            BOOST_CHECK(out == ref);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
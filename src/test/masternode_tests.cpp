@@ -0,0 +1,395 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "clientversion.h"
+#include "key.h"
+#include "main.h"
+#include "masternode-collateral.h"
+#include "masternode.h"
+#include "masternodeman.h"
+#include "obfuscation.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "timedata.h"
+#include "txmempool.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+static CMasternode MakeMasternode(int n)
+{
+    CKey keyCollateral, keyMasternode;
+    keyCollateral.MakeNewKey(true);
+    keyMasternode.MakeNewKey(true);
+
+    CMasternode mn;
+    mn.vin = CTxIn(COutPoint(uint256(n + 1), 0));
+    mn.pubKeyCollateralAddress = keyCollateral.GetPubKey();
+    mn.pubKeyMasternode = keyMasternode.GetPubKey();
+    mn.unitTest = true;
+    mn.lastPing.vin = mn.vin;
+    mn.lastPing.sigTime = GetAdjustedTime();
+    return mn;
+}
+
+// An unspent output in the coins tip, as if a block had confirmed it
+static COutPoint AddCoin()
+{
+    LOCK(cs_main);
+    COutPoint outpoint(GetRandHash(), 0);
+    CCoinsModifier coins = pcoinsTip->ModifyCoins(outpoint.hash);
+    coins->vout.resize(1);
+    coins->vout[0].nValue = 10000 * COIN;
+    coins->vout[0].scriptPubKey = CScript() << OP_1;
+    coins->nHeight = 1;
+    return outpoint;
+}
+
+static void RemoveCoin(const COutPoint& outpoint)
+{
+    LOCK(cs_main);
+    pcoinsTip->ModifyCoins(outpoint.hash)->Clear();
+}
+
+static CTransaction SpendCoin(const COutPoint& outpoint)
+{
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(outpoint));
+    tx.vout.push_back(CTxOut(10000 * COIN, CScript() << OP_1));
+    return tx;
+}
+
+static CScript GetPayee(const CMasternode& mn)
+{
+    return GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
+}
+
+// Every listed masternode is found by its collateral, payee and key, and no removed one is
+static void CheckIndexes(CMasternodeMan& man, const std::vector<CMasternode>& vListed, const std::vector<CMasternode>& vRemoved)
+{
+    BOOST_CHECK_EQUAL(man.size(), (int)vListed.size());
+    BOOST_FOREACH (const CMasternode& mn, vListed) {
+        CMasternode* pmn = man.Find(mn.vin);
+        BOOST_REQUIRE(pmn != NULL);
+        BOOST_CHECK(pmn->vin == mn.vin);
+        BOOST_CHECK(man.Find(GetPayee(mn)) == pmn);
+        BOOST_CHECK(man.Find(mn.pubKeyMasternode) == pmn);
+    }
+    BOOST_FOREACH (const CMasternode& mn, vRemoved) {
+        BOOST_CHECK(man.Find(mn.vin) == NULL);
+        BOOST_CHECK(man.Find(GetPayee(mn)) == NULL);
+        BOOST_CHECK(man.Find(mn.pubKeyMasternode) == NULL);
+    }
+}
+
+// The ranking by a fresh sort of the scores: highest first, ties to the one earlier in the list
+static std::vector<CTxIn> GetFreshRanking(const std::vector<CMasternode>& vListed, const uint256& hashBlock)
+{
+    std::vector<std::pair<int64_t, size_t> > vScores;
+    for (size_t i = 0; i < vListed.size(); i++) {
+        CMasternode mn(vListed[i]);
+        vScores.push_back(std::make_pair(-(int64_t)mn.CalculateScore(hashBlock).GetCompact(false), i));
+    }
+    std::sort(vScores.begin(), vScores.end());
+    std::vector<CTxIn> vRanked;
+    for (size_t i = 0; i < vScores.size(); i++)
+        vRanked.push_back(vListed[vScores[i].second].vin);
+    return vRanked;
+}
+
+// The ranks given by the manager for nBlockHeight match the fresh ranking
+static void CheckRanking(CMasternodeMan& man, const std::vector<CMasternode>& vListed, const std::vector<CMasternode>& vRemoved, int64_t nBlockHeight)
+{
+    std::vector<CTxIn> vRanked = GetFreshRanking(vListed, mapCacheBlockHashes[nBlockHeight]);
+    CMasternode* pmn = man.GetCurrentMasterNode(1, nBlockHeight);
+    BOOST_REQUIRE(pmn != NULL);
+    BOOST_CHECK(pmn->vin == vRanked[0]);
+    for (size_t i = 0; i < vRanked.size(); i++) {
+        BOOST_CHECK_EQUAL(man.GetMasternodeRank(vRanked[i], nBlockHeight), (int)i + 1);
+        pmn = man.GetMasternodeByRank(i + 1, nBlockHeight);
+        BOOST_REQUIRE(pmn != NULL);
+        BOOST_CHECK(pmn->vin == vRanked[i]);
+    }
+    BOOST_CHECK(man.GetMasternodeByRank(vRanked.size() + 1, nBlockHeight) == NULL);
+    BOOST_FOREACH (const CMasternode& mn, vRemoved)
+        BOOST_CHECK_EQUAL(man.GetMasternodeRank(mn.vin, nBlockHeight), -1);
+}
+
+BOOST_AUTO_TEST_SUITE(masternode_tests)
+
+BOOST_AUTO_TEST_CASE(masternode_indexes)
+{
+    CMasternodeMan man;
+    std::vector<CMasternode> vListed, vRemoved;
+    for (int i = 0; i < 6; i++) {
+        CMasternode mn = MakeMasternode(i);
+        BOOST_CHECK(man.Add(mn));
+        vListed.push_back(mn);
+    }
+    BOOST_CHECK(!man.Add(vListed[0]));
+    CheckIndexes(man, vListed, vRemoved);
+
+    // Removing one from the middle moves the ones after it
+    man.Remove(vListed[2].vin);
+    vRemoved.push_back(vListed[2]);
+    vListed.erase(vListed.begin() + 2);
+    CheckIndexes(man, vListed, vRemoved);
+
+    // Removing an unknown one changes nothing
+    man.Remove(MakeMasternode(100).vin);
+    CheckIndexes(man, vListed, vRemoved);
+
+    // CheckAndRemove drops the ones not pinged for too long
+    man.Find(vListed[0].vin)->lastPing.sigTime = GetAdjustedTime() - MASTERNODE_REMOVAL_SECONDS - 1;
+    man.Find(vListed[3].vin)->lastPing.sigTime = GetAdjustedTime() - MASTERNODE_REMOVAL_SECONDS - 1;
+    man.CheckAndRemove();
+    vRemoved.push_back(vListed[3]);
+    vRemoved.push_back(vListed[0]);
+    vListed.erase(vListed.begin() + 3);
+    vListed.erase(vListed.begin());
+    CheckIndexes(man, vListed, vRemoved);
+
+    // A newer broadcast with another masternode key moves its entry in the key index
+    CMasternode* pmn = man.Find(vListed[1].vin);
+    CKey keyMasternode;
+    keyMasternode.MakeNewKey(true);
+    CMasternodeBroadcast mnb(pmn->addr, pmn->vin, pmn->pubKeyCollateralAddress, keyMasternode.GetPubKey(), pmn->protocolVersion);
+    mnb.sigTime = pmn->sigTime + 1;
+    CMasternode mnOld = vListed[1];
+    BOOST_CHECK(man.UpdateFromNewBroadcast(*pmn, mnb));
+    vListed[1].pubKeyMasternode = keyMasternode.GetPubKey();
+    BOOST_CHECK(man.Find(mnOld.pubKeyMasternode) == NULL);
+    CheckIndexes(man, vListed, vRemoved);
+
+    // An older one changes nothing
+    mnb.pubKeyMasternode = mnOld.pubKeyMasternode;
+    mnb.sigTime = pmn->sigTime - 1;
+    BOOST_CHECK(!man.UpdateFromNewBroadcast(*pmn, mnb));
+    CheckIndexes(man, vListed, vRemoved);
+
+    // The indexes are not serialized, but built again when the list is read
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << man;
+    CMasternodeMan manRead;
+    ss >> manRead;
+    CheckIndexes(manRead, vListed, vRemoved);
+}
+
+// A ping checked ahead on the message check queue is a signature cache hit when it is processed
+BOOST_AUTO_TEST_CASE(masternode_ping_preverified)
+{
+    CKey keyMasternode, keyOther;
+    keyMasternode.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    CPubKey pubKeyMasternode = keyMasternode.GetPubKey();
+
+    CMasternodePing mnp;
+    mnp.vin = CTxIn(COutPoint(GetRandHash(), 0));
+    mnp.blockHash = GetRandHash();
+    mnp.sigTime = GetAdjustedTime();
+    std::string strMessage = mnp.GetStrMessage();
+    std::string errorMessage;
+    BOOST_REQUIRE(obfuScationSigner.SignMessage(strMessage, errorMessage, mnp.vchSig, keyMasternode));
+
+    uint64_t nHits0, nMisses0, nHits, nMisses;
+    GetSignatureCacheStats(nHits0, nMisses0);
+
+    CMessageSignatureCheck check(pubKeyMasternode, mnp.vchSig, strMessage);
+    BOOST_CHECK(check());
+    GetSignatureCacheStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits, nHits0);
+    BOOST_CHECK_EQUAL(nMisses, nMisses0 + 1);
+
+    BOOST_CHECK(obfuScationSigner.VerifyMessage(pubKeyMasternode, mnp.vchSig, strMessage, errorMessage));
+    GetSignatureCacheStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits, nHits0 + 1);
+    BOOST_CHECK_EQUAL(nMisses, nMisses0 + 1);
+
+    // Checked against the wrong key it is not cached, and still rejected when processed
+    CMessageSignatureCheck checkOther(keyOther.GetPubKey(), mnp.vchSig, strMessage);
+    BOOST_CHECK(checkOther());
+    BOOST_CHECK(!obfuScationSigner.VerifyMessage(keyOther.GetPubKey(), mnp.vchSig, strMessage, errorMessage));
+    GetSignatureCacheStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits, nHits0 + 1);
+    BOOST_CHECK_EQUAL(nMisses, nMisses0 + 3);
+}
+
+// The score tables cached per height give the same ranks as sorting the scores again
+BOOST_AUTO_TEST_CASE(masternode_score_cache)
+{
+    // Heights past the tip, with the block hashes set up front
+    const int64_t nHeight = 1000;
+    for (int64_t h = nHeight; h <= nHeight + MASTERNODES_SCORE_CACHE_HEIGHTS + 1; h++)
+        mapCacheBlockHashes[h] = GetRandHash();
+
+    CMasternodeMan man;
+    std::vector<CMasternode> vListed, vRemoved;
+    for (int i = 0; i < 8; i++) {
+        CMasternode mn = MakeMasternode(i);
+        BOOST_CHECK(man.Add(mn));
+        vListed.push_back(mn);
+    }
+    CheckRanking(man, vListed, vRemoved, nHeight);
+    CheckRanking(man, vListed, vRemoved, nHeight);
+
+    CMasternode mnNew = MakeMasternode(8);
+    BOOST_CHECK(man.Add(mnNew));
+    vListed.push_back(mnNew);
+    CheckRanking(man, vListed, vRemoved, nHeight);
+
+    man.Remove(vListed[3].vin);
+    vRemoved.push_back(vListed[3]);
+    vListed.erase(vListed.begin() + 3);
+    CheckRanking(man, vListed, vRemoved, nHeight);
+
+    man.Find(vListed[1].vin)->lastPing.sigTime = GetAdjustedTime() - MASTERNODE_REMOVAL_SECONDS - 1;
+    man.CheckAndRemove();
+    vRemoved.push_back(vListed[1]);
+    vListed.erase(vListed.begin() + 1);
+    CheckRanking(man, vListed, vRemoved, nHeight);
+
+    // Another block at the same height, after a reorg
+    mapCacheBlockHashes[nHeight] = GetRandHash();
+    CheckRanking(man, vListed, vRemoved, nHeight);
+
+    // More heights than are cached, then back to the first ones, which were dropped
+    for (int64_t h = nHeight + 1; h <= nHeight + MASTERNODES_SCORE_CACHE_HEIGHTS + 1; h++)
+        CheckRanking(man, vListed, vRemoved, h);
+    CheckRanking(man, vListed, vRemoved, nHeight);
+    CheckRanking(man, vListed, vRemoved, nHeight + 1);
+
+    // Two collaterals with the same compact score for a block
+    const int64_t nHeightTie = nHeight + MASTERNODES_SCORE_CACHE_HEIGHTS + 2;
+    uint256 hashTie = GetRandHash();
+    mapCacheBlockHashes[nHeightTie] = hashTie;
+    std::map<uint32_t, int> mapSeen;
+    int nFirst = -1, nSecond = -1;
+    for (int n = 100; nSecond < 0; n++) {
+        CMasternode mn;
+        mn.vin = CTxIn(COutPoint(uint256(n + 1), 0));
+        uint32_t nScore = mn.CalculateScore(hashTie).GetCompact(false);
+        if (mapSeen.count(nScore)) {
+            nFirst = mapSeen[nScore];
+            nSecond = n;
+        }
+        mapSeen[nScore] = n;
+    }
+    CMasternode mnFirst = MakeMasternode(nFirst), mnSecond = MakeMasternode(nSecond);
+    BOOST_REQUIRE(mnFirst.CalculateScore(hashTie).GetCompact(false) == mnSecond.CalculateScore(hashTie).GetCompact(false));
+
+    // The one earlier in the list wins the tie, whichever it is
+    CMasternodeMan manTie;
+    BOOST_CHECK(manTie.Add(mnFirst));
+    BOOST_CHECK(manTie.Add(mnSecond));
+    BOOST_CHECK(manTie.GetCurrentMasterNode(1, nHeightTie)->vin == mnFirst.vin);
+    BOOST_CHECK_EQUAL(manTie.GetMasternodeRank(mnFirst.vin, nHeightTie), 1);
+    BOOST_CHECK_EQUAL(manTie.GetMasternodeRank(mnSecond.vin, nHeightTie), 2);
+
+    CMasternodeMan manTieSwapped;
+    BOOST_CHECK(manTieSwapped.Add(mnSecond));
+    BOOST_CHECK(manTieSwapped.Add(mnFirst));
+    BOOST_CHECK(manTieSwapped.GetCurrentMasterNode(1, nHeightTie)->vin == mnSecond.vin);
+    BOOST_CHECK_EQUAL(manTieSwapped.GetMasternodeRank(mnSecond.vin, nHeightTie), 1);
+    BOOST_CHECK_EQUAL(manTieSwapped.GetMasternodeRank(mnFirst.vin, nHeightTie), 2);
+    BOOST_CHECK(manTieSwapped.GetMasternodeByRank(1, nHeightTie)->vin == mnSecond.vin);
+
+    for (int64_t h = nHeight; h <= nHeightTie; h++)
+        mapCacheBlockHashes.erase(h);
+}
+
+// The collateral tracker follows the spends it is told about by the mempool and connected blocks
+BOOST_AUTO_TEST_CASE(masternode_collateral)
+{
+    RegisterValidationInterface(&masternodeCollateral);
+    masternodeCollateral.Clear();
+
+    // The first lookup finds the collaterals unspent and watches them from then on
+    COutPoint outpointMempool = AddCoin(), outpointBlock = AddCoin();
+    bool fSpent = true;
+    BOOST_CHECK(masternodeCollateral.IsSpent(outpointMempool, fSpent));
+    BOOST_CHECK(!fSpent);
+    fSpent = true;
+    BOOST_CHECK(masternodeCollateral.IsSpent(outpointBlock, fSpent));
+    BOOST_CHECK(!fSpent);
+    BOOST_CHECK_EQUAL(masternodeCollateral.size(), 2);
+
+    // A spend accepted to the mempool
+    SyncWithWallets(SpendCoin(outpointMempool), NULL);
+    BOOST_CHECK(masternodeCollateral.IsSpent(outpointMempool, fSpent));
+    BOOST_CHECK(fSpent);
+    BOOST_CHECK(masternodeCollateral.IsSpent(outpointBlock, fSpent));
+    BOOST_CHECK(!fSpent);
+
+    // A spend in a connected block
+    CBlock block;
+    block.vtx.push_back(SpendCoin(outpointBlock));
+    SyncWithWallets(block.vtx[0], &block);
+    BOOST_CHECK(masternodeCollateral.IsSpent(outpointBlock, fSpent));
+    BOOST_CHECK(fSpent);
+
+    // Outputs already spent in the mempool, or not in the coins at all, are spent on the first lookup
+    COutPoint outpointInMempool = AddCoin();
+    CTransaction txInMempool = SpendCoin(outpointInMempool);
+    mempool.addUnchecked(txInMempool.GetHash(), CTxMemPoolEntry(txInMempool, 0, GetTime(), 0.0, 1, 0));
+    fSpent = false;
+    BOOST_CHECK(masternodeCollateral.IsSpent(outpointInMempool, fSpent));
+    BOOST_CHECK(fSpent);
+    fSpent = false;
+    BOOST_CHECK(masternodeCollateral.IsSpent(COutPoint(GetRandHash(), 0), fSpent));
+    BOOST_CHECK(fSpent);
+    mempool.clear();
+
+    // While another thread holds cs_main, an outpoint that isn't watched yet is unknown;
+    // watched ones are still answered
+    COutPoint outpointBusy = AddCoin();
+    std::atomic<bool> fLocked(false), fRelease(false);
+    boost::thread threadMain([&]() {
+        LOCK(cs_main);
+        fLocked = true;
+        while (!fRelease)
+            MilliSleep(1);
+    });
+    while (!fLocked)
+        MilliSleep(1);
+    BOOST_CHECK(!masternodeCollateral.IsSpent(outpointBusy, fSpent));
+    BOOST_CHECK(masternodeCollateral.IsSpent(outpointBlock, fSpent));
+    BOOST_CHECK(fSpent);
+    fRelease = true;
+    threadMain.join();
+    fSpent = true;
+    BOOST_CHECK(masternodeCollateral.IsSpent(outpointBusy, fSpent));
+    BOOST_CHECK(!fSpent);
+
+    // Forgotten outpoints are no longer watched; the next lookup starts over
+    size_t nWatched = masternodeCollateral.size();
+    masternodeCollateral.Forget(outpointBusy);
+    BOOST_CHECK_EQUAL(masternodeCollateral.size(), nWatched - 1);
+    masternodeCollateral.Forget(outpointBlock);
+    BOOST_CHECK_EQUAL(masternodeCollateral.size(), nWatched - 2);
+    SyncWithWallets(SpendCoin(outpointBusy), NULL);
+    BOOST_CHECK_EQUAL(masternodeCollateral.size(), nWatched - 2);
+    BOOST_CHECK(masternodeCollateral.IsSpent(outpointBusy, fSpent));
+    BOOST_CHECK(!fSpent);
+
+    // Clearing the masternode list stops watching every collateral
+    CMasternodeMan man;
+    man.Clear();
+    BOOST_CHECK_EQUAL(masternodeCollateral.size(), 0);
+
+    RemoveCoin(outpointMempool);
+    RemoveCoin(outpointBlock);
+    RemoveCoin(outpointInMempool);
+    RemoveCoin(outpointBusy);
+    UnregisterValidationInterface(&masternodeCollateral);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,10 +2,17 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
+#include "key.h"
+#include "keystore.h"
 #include "main.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "streams.h"
 #include "txmempool.h"
 #include "util.h"
 
+#include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
 #include <list>
 
@@ -58,17 +65,17 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     BOOST_CHECK_EQUAL(removed.size(), 0);
 
     // Just the parent:
-    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1));
+    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1, 0));
     testPool.remove(txParent, removed, true);
     BOOST_CHECK_EQUAL(removed.size(), 1);
     removed.clear();
     
     // Parent, children, grandchildren:
-    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1));
+    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1, 0));
     for (int i = 0; i < 3; i++)
     {
-        testPool.addUnchecked(txChild[i].GetHash(), CTxMemPoolEntry(txChild[i], 0, 0, 0.0, 1));
-        testPool.addUnchecked(txGrandChild[i].GetHash(), CTxMemPoolEntry(txGrandChild[i], 0, 0, 0.0, 1));
+        testPool.addUnchecked(txChild[i].GetHash(), CTxMemPoolEntry(txChild[i], 0, 0, 0.0, 1, 0));
+        testPool.addUnchecked(txGrandChild[i].GetHash(), CTxMemPoolEntry(txGrandChild[i], 0, 0, 0.0, 1, 0));
     }
     // Remove Child[0], GrandChild[0] should be removed:
     testPool.remove(txChild[0], removed, true);
@@ -88,8 +95,8 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     // Add children and grandchildren, but NOT the parent (simulate the parent being in a block)
     for (int i = 0; i < 3; i++)
     {
-        testPool.addUnchecked(txChild[i].GetHash(), CTxMemPoolEntry(txChild[i], 0, 0, 0.0, 1));
-        testPool.addUnchecked(txGrandChild[i].GetHash(), CTxMemPoolEntry(txGrandChild[i], 0, 0, 0.0, 1));
+        testPool.addUnchecked(txChild[i].GetHash(), CTxMemPoolEntry(txChild[i], 0, 0, 0.0, 1, 0));
+        testPool.addUnchecked(txGrandChild[i].GetHash(), CTxMemPoolEntry(txGrandChild[i], 0, 0, 0.0, 1, 0));
     }
     // Now remove the parent, as might happen if a block-re-org occurs but the parent cannot be
     // put into the mempool (maybe because it is non-standard):
@@ -99,4 +106,305 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolIndexesTest)
+{
+    // Test the parent links and orderings CTxMemPool keeps
+
+    // Parent with two children, the second one also spending the first:
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 11000LL;
+    CMutableTransaction txChild2;
+    txChild2.vin.resize(2);
+    txChild2.vin[0].scriptSig = CScript() << OP_11;
+    txChild2.vin[0].prevout = COutPoint(txParent.GetHash(), 1);
+    txChild2.vin[1].scriptSig = CScript() << OP_11;
+    txChild2.vin[1].prevout = COutPoint(txChild.GetHash(), 0);
+    txChild2.vout.resize(1);
+    txChild2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild2.vout[0].nValue = 11000LL;
+    const uint256 hashParent = txParent.GetHash();
+    const uint256 hashChild = txChild.GetHash();
+    const uint256 hashChild2 = txChild2.GetHash();
+
+    CTxMemPool testPool(CFeeRate(0));
+    std::list<CTransaction> removed;
+
+    // Children first, as when the parent comes back after a reorg
+    testPool.addUnchecked(hashChild, CTxMemPoolEntry(txChild, 30000, 2, 10.0, 1, 0));
+    testPool.addUnchecked(hashChild2, CTxMemPoolEntry(txChild2, 1000, 3, 100.0, 1, 1000000));
+    testPool.addUnchecked(hashParent, CTxMemPoolEntry(txParent, 10000, 1, 1000.0, 1, 0));
+    {
+        LOCK(testPool.cs);
+        const CTxMemPoolEntry& parent = testPool.mapTx[hashParent];
+        const CTxMemPoolEntry& child = testPool.mapTx[hashChild];
+        const CTxMemPoolEntry& child2 = testPool.mapTx[hashChild2];
+        BOOST_CHECK(parent.GetMemPoolParents().empty());
+        BOOST_CHECK_EQUAL(parent.GetMemPoolChildren().size(), 2);
+        BOOST_CHECK_EQUAL(child.GetMemPoolParents().size(), 1);
+        BOOST_CHECK_EQUAL(child.GetMemPoolChildren().size(), 1);
+        BOOST_CHECK_EQUAL(child2.GetMemPoolParents().size(), 2);
+        BOOST_CHECK(child2.GetMemPoolChildren().empty());
+
+        // Fee rate: child, parent, child2
+        CTxMemPool::TxFeeRateIndex::const_iterator itFee = testPool.GetFeeRateIndex().begin();
+        BOOST_CHECK(itFee->second == hashChild);
+        BOOST_CHECK((++itFee)->second == hashParent);
+        BOOST_CHECK((++itFee)->second == hashChild2);
+        // Entry time: parent, child, child2
+        CTxMemPool::TxTimeIndex::const_iterator itTime = testPool.GetTimeIndex().begin();
+        BOOST_CHECK(itTime->second == hashParent);
+        BOOST_CHECK((++itTime)->second == hashChild);
+        BOOST_CHECK((++itTime)->second == hashChild2);
+        // Priority: parent first, until child2's inputs in the chain have aged
+        BOOST_CHECK(testPool.GetPriorityIndex(1).begin()->second == hashParent);
+        BOOST_CHECK(testPool.GetPriorityIndex(1000).begin()->second == hashChild2);
+    }
+
+    // Prioritising moves a transaction in the orderings
+    testPool.PrioritiseTransaction(hashChild2, hashChild2.ToString(), 0.0, 1000000);
+    {
+        LOCK(testPool.cs);
+        BOOST_CHECK(testPool.GetFeeRateIndex().begin()->second == hashChild2);
+    }
+    testPool.ClearPrioritisation(hashChild2);
+    {
+        LOCK(testPool.cs);
+        BOOST_CHECK(testPool.GetFeeRateIndex().rbegin()->second == hashChild2);
+    }
+
+    // Removing the parent without its children (mined) unlinks them
+    testPool.remove(txParent, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    removed.clear();
+    {
+        LOCK(testPool.cs);
+        BOOST_CHECK(testPool.mapTx[hashChild].GetMemPoolParents().empty());
+        BOOST_CHECK_EQUAL(testPool.mapTx[hashChild2].GetMemPoolParents().size(), 1);
+        BOOST_CHECK_EQUAL(testPool.GetFeeRateIndex().size(), 2);
+        BOOST_CHECK_EQUAL(testPool.GetTimeIndex().size(), 2);
+    }
+    testPool.remove(txChild, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    {
+        LOCK(testPool.cs);
+        BOOST_CHECK(testPool.GetFeeRateIndex().empty());
+        BOOST_CHECK(testPool.GetPriorityIndex(1).empty());
+        BOOST_CHECK(testPool.GetTimeIndex().empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    // Three unrelated transactions, and a child of the cheapest one paying
+    // even less per byte
+    CMutableTransaction tx[4];
+    for (int i = 0; i < 4; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_1;
+        tx[i].vin[0].prevout.hash = GetRandHash();
+        tx[i].vin[0].prevout.n = 0;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    tx[3].vin[0].prevout.hash = tx[2].GetHash();
+
+    pool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 30000, 1, 0.0, 1, 0));
+    pool.addUnchecked(tx[1].GetHash(), CTxMemPoolEntry(tx[1], 20000, 2, 0.0, 1, 0));
+    pool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], 10000, 3, 0.0, 1, 0));
+    pool.addUnchecked(tx[3].GetHash(), CTxMemPoolEntry(tx[3], 5000, 4, 0.0, 1, 0));
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    // Nothing to do below the limit
+    size_t nUsage = pool.DynamicMemoryUsage();
+    pool.TrimToSize(nUsage);
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+
+    // Going over it evicts the child first, and getting back in takes more than it paid
+    pool.TrimToSize(nUsage - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK(!pool.exists(tx[3].GetHash()));
+    BOOST_CHECK(pool.DynamicMemoryUsage() < nUsage);
+    CFeeRate rateChild(5000, ::GetSerializeSize(tx[3], SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), rateChild.GetFeePerK() + 1000);
+
+    // A transaction goes with what spends it, and the minimum fee becomes
+    // the fee rate of them together if that is higher
+    pool.addUnchecked(tx[3].GetHash(), CTxMemPoolEntry(tx[3], 50000, 4, 0.0, 1, 0));
+    nUsage = pool.DynamicMemoryUsage();
+    pool.TrimToSize(nUsage - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    BOOST_CHECK(!pool.exists(tx[2].GetHash()));
+    BOOST_CHECK(!pool.exists(tx[3].GetHash()));
+    CFeeRate ratePackage(60000, ::GetSerializeSize(tx[2], SER_NETWORK, PROTOCOL_VERSION) + ::GetSerializeSize(tx[3], SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), ratePackage.GetFeePerK() + 1000);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK(pool.exists(tx[0].GetHash()));
+
+    // Expiry removes what entered before the given time, with what spends it
+    pool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], 10000, 3, 0.0, 1, 0));
+    pool.addUnchecked(tx[3].GetHash(), CTxMemPoolEntry(tx[3], 5000, 5, 0.0, 1, 0));
+    BOOST_CHECK_EQUAL(pool.Expire(3), 1);
+    BOOST_CHECK_EQUAL(pool.Expire(4), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+}
+
+// A signed transaction spending the first output of txFrom to key
+static CTransaction SpendToKey(const CKeyStore& keystore, const CTransaction& txFrom, const CKey& key, CAmount nFee)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txFrom.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = txFrom.vout[0].nValue - nFee;
+    tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    BOOST_CHECK(SignSignature(keystore, txFrom, tx, 0));
+    return tx;
+}
+
+static void WriteMempoolFile(const std::vector<char>& vch)
+{
+    FILE* file = fopen((GetDataDir() / "mempool.dat").string().c_str(), "wb");
+    BOOST_REQUIRE(file != NULL);
+    BOOST_REQUIRE(vch.empty() || fwrite(&vch[0], 1, vch.size(), file) == vch.size());
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPersistTest)
+{
+    LOCK(cs_main);
+    mempool.clear();
+
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+
+    // Coins to spend, straight in the chainstate
+    std::vector<CTransaction> vFund;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction txFund;
+        txFund.vin.resize(1);
+        txFund.vin[0].prevout = COutPoint(GetRandHash(), i);
+        txFund.vout.resize(1);
+        txFund.vout[0].nValue = COIN;
+        txFund.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+        vFund.push_back(txFund);
+        *pcoinsTip->ModifyCoins(vFund.back().GetHash()) = CCoins(vFund.back(), chainActive.Height());
+    }
+
+    // One transaction old enough to have expired by the time it is loaded,
+    // the others a bit apart, one of them with a child
+    int64_t nTime = GetTime();
+    CTransaction txOld = SpendToKey(keystore, vFund[0], key, 100000);
+    CTransaction txParent = SpendToKey(keystore, vFund[1], key, 100000);
+    CTransaction txChild = SpendToKey(keystore, txParent, key, 100000);
+    CTransaction txOther = SpendToKey(keystore, vFund[2], key, 100000);
+    CValidationState state;
+    SetMockTime(nTime - 10);
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, txOld, true, NULL));
+    SetMockTime(nTime);
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, txParent, true, NULL));
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, txChild, true, NULL));
+    SetMockTime(nTime + 1);
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, txOther, true, NULL));
+    BOOST_CHECK_EQUAL(mempool.size(), 4);
+
+    // Deltas are kept, also those of transactions not in the pool
+    uint256 hashAbsent = GetRandHash();
+    mempool.PrioritiseTransaction(txOther.GetHash(), txOther.GetHash().ToString(), 100.0, 5000);
+    mempool.PrioritiseTransaction(hashAbsent, hashAbsent.ToString(), 1.0, 7);
+
+    BOOST_CHECK(DumpMempool());
+    std::vector<char> vchDump;
+    {
+        FILE* file = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+        BOOST_REQUIRE(file != NULL);
+        char buf[4096];
+        size_t nRead;
+        while ((nRead = fread(buf, 1, sizeof(buf), file)) > 0)
+            vchDump.insert(vchDump.end(), buf, buf + nRead);
+        fclose(file);
+    }
+
+    mempool.clear();
+    mempool.ClearPrioritisation(txOther.GetHash());
+    mempool.ClearPrioritisation(hashAbsent);
+
+    // Loaded when txOld is just past -mempoolexpiry and the others are not
+    SetMockTime(nTime - 10 + DEFAULT_MEMPOOL_EXPIRY * 60 * 60);
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 3);
+    BOOST_CHECK(!mempool.exists(txOld.GetHash()));
+    {
+        LOCK(mempool.cs);
+        BOOST_REQUIRE(mempool.exists(txParent.GetHash()) && mempool.exists(txChild.GetHash()) && mempool.exists(txOther.GetHash()));
+        BOOST_CHECK_EQUAL(mempool.mapTx[txParent.GetHash()].GetTime(), nTime);
+        BOOST_CHECK_EQUAL(mempool.mapTx[txChild.GetHash()].GetTime(), nTime);
+        const CTxMemPoolEntry& entry = mempool.mapTx[txOther.GetHash()];
+        BOOST_CHECK_EQUAL(entry.GetTime(), nTime + 1);
+        BOOST_CHECK_EQUAL(entry.GetModifiedFee() - entry.GetFee(), 5000);
+    }
+    double dPriorityDelta = 0;
+    CAmount nFeeDelta = 0;
+    mempool.ApplyDeltas(txOther.GetHash(), dPriorityDelta, nFeeDelta);
+    BOOST_CHECK_EQUAL(dPriorityDelta, 100.0);
+    BOOST_CHECK_EQUAL(nFeeDelta, 5000);
+    dPriorityDelta = 0;
+    nFeeDelta = 0;
+    mempool.ApplyDeltas(hashAbsent, dPriorityDelta, nFeeDelta);
+    BOOST_CHECK_EQUAL(dPriorityDelta, 1.0);
+    BOOST_CHECK_EQUAL(nFeeDelta, 7);
+
+    // A truncated file adds nothing, deltas included
+    mempool.clear();
+    mempool.ClearPrioritisation(txOther.GetHash());
+    mempool.ClearPrioritisation(hashAbsent);
+    WriteMempoolFile(std::vector<char>(vchDump.begin(), vchDump.end() - 10));
+    BOOST_CHECK(!LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+    nFeeDelta = 0;
+    mempool.ApplyDeltas(hashAbsent, dPriorityDelta, nFeeDelta);
+    BOOST_CHECK_EQUAL(nFeeDelta, 0);
+
+    // So does one of another version
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << (uint64_t)2 << (uint64_t)0;
+    WriteMempoolFile(std::vector<char>(ss.begin(), ss.end()));
+    BOOST_CHECK(!LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+
+    // The whole file loads again
+    WriteMempoolFile(vchDump);
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 3);
+
+    mempool.clear();
+    mempool.ClearPrioritisation(txOther.GetHash());
+    mempool.ClearPrioritisation(hashAbsent);
+    boost::filesystem::remove(GetDataDir() / "mempool.dat");
+    BOOST_FOREACH (const CTransaction& txFund, vFund)
+        pcoinsTip->ModifyCoins(txFund.GetHash())->Clear();
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,13 +2,20 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
+#include "checkpoints.h"
 #include "init.h"
 #include "main.h"
 #include "miner.h"
 #include "pubkey.h"
+#include "script/standard.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <algorithm>
+#include <list>
+#include <set>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_AUTO_TEST_SUITE(miner_tests)
@@ -104,7 +111,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     {
         tx.vout[0].nValue -= 1000000;
         hash = tx.GetHash();
-        mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
+        mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11, 0));
         tx.vin[0].prevout.hash = hash;
     }
     BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
@@ -124,7 +131,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     {
         tx.vout[0].nValue -= 10000000;
         hash = tx.GetHash();
-        mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
+        mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11, 0));
         tx.vin[0].prevout.hash = hash;
     }
     BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
@@ -133,7 +140,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 
     // orphan in mempool
     hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11, 0));
     BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
     delete pblocktemplate;
     mempool.clear();
@@ -143,7 +150,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx.vin[0].prevout.hash = txFirst[1]->GetHash();
     tx.vout[0].nValue = 4900000000LL;
     hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11, 0));
     tx.vin[0].prevout.hash = hash;
     tx.vin.resize(2);
     tx.vin[1].scriptSig = CScript() << OP_1;
@@ -151,7 +158,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx.vin[1].prevout.n = 0;
     tx.vout[0].nValue = 5900000000LL;
     hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11, 0));
     BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
     delete pblocktemplate;
     mempool.clear();
@@ -162,7 +169,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx.vin[0].scriptSig = CScript() << OP_0 << OP_1;
     tx.vout[0].nValue = 0;
     hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11, 0));
     BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
     delete pblocktemplate;
     mempool.clear();
@@ -175,12 +182,12 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     script = CScript() << OP_0;
     tx.vout[0].scriptPubKey = GetScriptForDestination(CScriptID(script));
     hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11, 0));
     tx.vin[0].prevout.hash = hash;
     tx.vin[0].scriptSig = CScript() << (std::vector<unsigned char>)script;
     tx.vout[0].nValue -= 1000000;
     hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11, 0));
     BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
     delete pblocktemplate;
     mempool.clear();
@@ -191,10 +198,10 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx.vout[0].nValue = 4900000000LL;
     tx.vout[0].scriptPubKey = CScript() << OP_1;
     hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11, 0));
     tx.vout[0].scriptPubKey = CScript() << OP_2;
     hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11, 0));
     BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
     delete pblocktemplate;
     mempool.clear();
@@ -220,7 +227,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx.vout[0].scriptPubKey = CScript() << OP_1;
     tx.nLockTime = chainActive.Tip()->nHeight+1;
     hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11, 0));
     BOOST_CHECK(!IsFinalTx(tx, chainActive.Tip()->nHeight + 1));
 
     // time locked
@@ -234,7 +241,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx2.vout[0].scriptPubKey = CScript() << OP_1;
     tx2.nLockTime = chainActive.Tip()->GetMedianTimePast()+1;
     hash = tx2.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx2, 11, GetTime(), 111.0, 11));
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx2, 11, GetTime(), 111.0, 11, 0));
     BOOST_CHECK(!IsFinalTx(tx2));
 
     BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
@@ -264,4 +271,292 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     Checkpoints::fEnabled = true;
 }
 
+// The mempool transactions of a new template, in block order
+static std::vector<uint256> NewTemplateTxids(const CScript& scriptPubKey)
+{
+    std::vector<uint256> vHash;
+    CBlockTemplate* pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false);
+    BOOST_REQUIRE(pblocktemplate);
+    for (size_t i = 1; i < pblocktemplate->block.vtx.size(); i++)
+        vHash.push_back(pblocktemplate->block.vtx[i].GetHash());
+    delete pblocktemplate;
+    return vHash;
+}
+
+// The same, with the transactions picked from scratch
+static std::vector<uint256> FreshTemplateTxids(const CScript& scriptPubKey)
+{
+    InvalidateBlockTemplate();
+    return NewTemplateTxids(scriptPubKey);
+}
+
+// Put a transaction paying nFee out of the first output of txFrom in the mempool
+static CTransaction AddToMempool(const CTransaction& txFrom, CAmount nFee, unsigned int nLockTime = 0)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txFrom.GetHash(), 0);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    if (nLockTime != 0)
+        tx.vin[0].nSequence = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = txFrom.vout[0].nValue - nFee;
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    tx.nLockTime = nLockTime;
+    mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, GetTime(), 0.0, chainActive.Height(), 0));
+    return tx;
+}
+
+static std::vector<uint256> Txids(const CTransaction& tx1, const CTransaction& tx2)
+{
+    std::vector<uint256> vHash;
+    vHash.push_back(tx1.GetHash());
+    vHash.push_back(tx2.GetHash());
+    return vHash;
+}
+
+static std::vector<uint256> Txids(const CTransaction& tx1, const CTransaction& tx2, const CTransaction& tx3)
+{
+    std::vector<uint256> vHash = Txids(tx1, tx2);
+    vHash.push_back(tx3.GetHash());
+    return vHash;
+}
+
+static std::vector<uint256> Txids(const CTransaction& tx1, const CTransaction& tx2, const CTransaction& tx3, const CTransaction& tx4)
+{
+    std::vector<uint256> vHash = Txids(tx1, tx2, tx3);
+    vHash.push_back(tx4.GetHash());
+    return vHash;
+}
+
+static bool Contains(const std::vector<uint256>& vHash, const CTransaction& tx)
+{
+    return std::find(vHash.begin(), vHash.end(), tx.GetHash()) != vHash.end();
+}
+
+// Templates on the same tip are extended with the new mempool transactions,
+// which then come after the ones picked before. Picked from scratch, all of
+// them are sorted by fee rate, so the order tells which way a template went.
+// Uses the chain CreateNewBlock_validity built.
+BOOST_AUTO_TEST_CASE(CreateNewBlock_template_cache)
+{
+    CScript scriptPubKey = CScript() << OP_1;
+
+    LOCK(cs_main);
+    Checkpoints::fEnabled = false;
+    mempool.clear();
+    InvalidateBlockTemplate();
+    // No priority part: free transactions only get in when prioritised
+    mapArgs["-blockprioritysize"] = "0";
+    int64_t nTime = GetTime();
+    SetMockTime(nTime);
+
+    std::vector<CTransaction> vCoinbase;
+    for (int nHeight = 3; nHeight < 10; nHeight++) {
+        CBlock block;
+        BOOST_REQUIRE(ReadBlockFromDisk(block, chainActive[nHeight]));
+        vCoinbase.push_back(block.vtx[0]);
+    }
+
+    // Extended with new transactions, a template holds what one picked from scratch does
+    CTransaction txA = AddToMempool(vCoinbase[0], 1000000);
+    CTransaction txB = AddToMempool(vCoinbase[1], 2000000);
+    std::vector<uint256> vHash = NewTemplateTxids(scriptPubKey);
+    BOOST_CHECK(vHash == Txids(txB, txA));
+    CTransaction txC = AddToMempool(vCoinbase[2], 4000000);
+    CTransaction txD = AddToMempool(txC, 4000000);
+    vHash = NewTemplateTxids(scriptPubKey);
+    BOOST_CHECK(vHash == Txids(txB, txA, txC, txD));
+    std::vector<uint256> vHashFresh = FreshTemplateTxids(scriptPubKey);
+    BOOST_CHECK(vHashFresh == Txids(txC, txD, txB, txA));
+    BOOST_CHECK(std::set<uint256>(vHash.begin(), vHash.end()) == std::set<uint256>(vHashFresh.begin(), vHashFresh.end()));
+
+    // Nothing changed: the same template
+    BOOST_CHECK(NewTemplateTxids(scriptPubKey) == vHashFresh);
+
+    // One of its transactions left the mempool: picked again
+    std::list<CTransaction> removed;
+    mempool.remove(txA, removed, true);
+    BOOST_CHECK(NewTemplateTxids(scriptPubKey) == Txids(txC, txD, txB));
+
+    // One it passed over left: still extended
+    CTransaction txFree = AddToMempool(vCoinbase[3], 0);
+    BOOST_CHECK(NewTemplateTxids(scriptPubKey) == Txids(txC, txD, txB));
+    CTransaction txH = AddToMempool(vCoinbase[4], 8000000);
+    BOOST_CHECK(NewTemplateTxids(scriptPubKey) == Txids(txC, txD, txB, txH));
+    mempool.remove(txFree, removed, true);
+    BOOST_CHECK(NewTemplateTxids(scriptPubKey) == Txids(txC, txD, txB, txH));
+
+    // A transaction was prioritised: picked again
+    CTransaction txP = AddToMempool(vCoinbase[5], 0);
+    BOOST_CHECK(!Contains(NewTemplateTxids(scriptPubKey), txP));
+    mempool.PrioritiseTransaction(txP.GetHash(), txP.GetHash().ToString(), 0.0, 16000000);
+    vHash = NewTemplateTxids(scriptPubKey);
+    BOOST_CHECK(vHash.size() == 5 && vHash[0] == txP.GetHash());
+
+    // Within the age limit a template is not picked again, even though a
+    // transaction it passed over became final; past it, it is
+    CTransaction txE = AddToMempool(vCoinbase[6], 1000000, nTime + 30);
+    BOOST_CHECK(!Contains(NewTemplateTxids(scriptPubKey), txE));
+    SetMockTime(nTime + 31);
+    BOOST_CHECK(IsFinalTx(txE));
+    BOOST_CHECK(!Contains(NewTemplateTxids(scriptPubKey), txE));
+    SetMockTime(nTime + 61);
+    vHash = NewTemplateTxids(scriptPubKey);
+    BOOST_CHECK(Contains(vHash, txE));
+    BOOST_CHECK_EQUAL(vHash.size(), 6);
+
+    // A new tip: picked again, without the transactions it confirmed
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    CBlockTemplate* pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false);
+    BOOST_REQUIRE(pblocktemplate);
+    CBlock* pblock = &pblocktemplate->block;
+    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlock(state, NULL, pblock));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == pblock->GetHash());
+    delete pblocktemplate;
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    CTransaction txAfter = AddToMempool(txE, 1000000);
+    pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txAfter.GetHash());
+    delete pblocktemplate;
+
+    mempool.clear();
+    InvalidateBlockTemplate();
+    mapArgs.erase("-blockprioritysize");
+    SetMockTime(0);
+    Checkpoints::fEnabled = true;
+}
+
+// Mine the mempool into a block on the tip, without proof of work
+static void MineMempool()
+{
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    CBlockTemplate* pblocktemplate = CreateNewBlock(CScript() << OP_1, pwalletMain, false);
+    BOOST_REQUIRE(pblocktemplate);
+    CBlock* pblock = &pblocktemplate->block;
+    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlock(state, NULL, pblock));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == pblock->GetHash());
+    delete pblocktemplate;
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+}
+
+// The address ('a'), unspent ('u') and spent ('p') index entries of a
+// block are written when it is connected and removed when it is
+// disconnected. Uses the chain CreateNewBlock_validity built.
+BOOST_AUTO_TEST_CASE(ConnectBlock_address_index)
+{
+    LOCK(cs_main);
+    Checkpoints::fEnabled = false;
+    mempool.clear();
+    InvalidateBlockTemplate();
+    fAddressIndex = true;
+
+    CBlock blockFrom;
+    BOOST_REQUIRE(ReadBlockFromDisk(blockFrom, chainActive[10]));
+    const CTransaction& txCoinbase = blockFrom.vtx[0];
+
+    // Pay to a script hash, which is spent again without a signature
+    CScript redeemScript = CScript() << OP_1;
+    CScriptID scriptID(redeemScript);
+    CMutableTransaction txPay;
+    txPay.vin.resize(1);
+    txPay.vin[0].prevout = COutPoint(txCoinbase.GetHash(), 0);
+    txPay.vin[0].scriptSig = CScript() << OP_1;
+    txPay.vout.resize(1);
+    txPay.vout[0].nValue = txCoinbase.vout[0].nValue - 1000000;
+    txPay.vout[0].scriptPubKey = GetScriptForDestination(scriptID);
+    const CAmount nValue = txPay.vout[0].nValue;
+    const uint256 hashPay = txPay.GetHash();
+    mempool.addUnchecked(hashPay, CTxMemPoolEntry(txPay, 1000000, GetTime(), 0.0, chainActive.Height(), 0));
+    MineMempool();
+    CBlockIndex* pindexPay = chainActive.Tip();
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    BOOST_CHECK(GetAddressIndex(scriptID, ADDRESS_INDEX_SCRIPT, vAddressIndex));
+    BOOST_REQUIRE_EQUAL(vAddressIndex.size(), 1);
+    BOOST_CHECK(vAddressIndex[0].first.txhash == hashPay);
+    BOOST_CHECK_EQUAL(vAddressIndex[0].first.nHeight, pindexPay->nHeight);
+    BOOST_CHECK(!vAddressIndex[0].first.fSpending);
+    BOOST_CHECK_EQUAL(vAddressIndex[0].second, nValue);
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(GetAddressUnspent(scriptID, ADDRESS_INDEX_SCRIPT, vUnspent));
+    BOOST_REQUIRE_EQUAL(vUnspent.size(), 1);
+    BOOST_CHECK(vUnspent[0].first.txhash == hashPay);
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nValue, nValue);
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nHeight, pindexPay->nHeight);
+    CSpentIndexValue spent;
+    BOOST_CHECK(!GetSpentIndex(CSpentIndexKey(hashPay, 0), spent));
+
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout = COutPoint(hashPay, 0);
+    txSpend.vin[0].scriptSig = CScript() << std::vector<unsigned char>(redeemScript.begin(), redeemScript.end());
+    txSpend.vout.resize(1);
+    txSpend.vout[0].nValue = nValue - 1000000;
+    txSpend.vout[0].scriptPubKey = CScript() << OP_1;
+    const uint256 hashSpend = txSpend.GetHash();
+    mempool.addUnchecked(hashSpend, CTxMemPoolEntry(txSpend, 1000000, GetTime(), 0.0, chainActive.Height(), 0));
+    MineMempool();
+    CBlockIndex* pindexSpend = chainActive.Tip();
+
+    vAddressIndex.clear();
+    BOOST_CHECK(GetAddressIndex(scriptID, ADDRESS_INDEX_SCRIPT, vAddressIndex));
+    BOOST_REQUIRE_EQUAL(vAddressIndex.size(), 2);
+    BOOST_CHECK(vAddressIndex[1].first.txhash == hashSpend);
+    BOOST_CHECK(vAddressIndex[1].first.fSpending);
+    BOOST_CHECK_EQUAL(vAddressIndex[1].second, -nValue);
+    vUnspent.clear();
+    BOOST_CHECK(GetAddressUnspent(scriptID, ADDRESS_INDEX_SCRIPT, vUnspent));
+    BOOST_CHECK(vUnspent.empty());
+    BOOST_REQUIRE(GetSpentIndex(CSpentIndexKey(hashPay, 0), spent));
+    BOOST_CHECK(spent.txid == hashSpend);
+    BOOST_CHECK_EQUAL(spent.nHeight, pindexSpend->nHeight);
+    BOOST_CHECK_EQUAL(spent.nValue, nValue);
+    BOOST_CHECK(spent.hashBytes == uint160(scriptID));
+
+    // Disconnecting the spend restores the unspent output and drops the spent entry
+    CValidationState state;
+    BOOST_CHECK(InvalidateBlock(state, pindexSpend));
+    BOOST_CHECK(chainActive.Tip() == pindexPay);
+    vAddressIndex.clear();
+    BOOST_CHECK(GetAddressIndex(scriptID, ADDRESS_INDEX_SCRIPT, vAddressIndex));
+    BOOST_CHECK_EQUAL(vAddressIndex.size(), 1);
+    vUnspent.clear();
+    BOOST_CHECK(GetAddressUnspent(scriptID, ADDRESS_INDEX_SCRIPT, vUnspent));
+    BOOST_REQUIRE_EQUAL(vUnspent.size(), 1);
+    BOOST_CHECK(vUnspent[0].first.txhash == hashPay);
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nHeight, pindexPay->nHeight);
+    BOOST_CHECK(!GetSpentIndex(CSpentIndexKey(hashPay, 0), spent));
+
+    // Disconnecting the payment leaves nothing for the address
+    BOOST_CHECK(InvalidateBlock(state, pindexPay));
+    vAddressIndex.clear();
+    BOOST_CHECK(GetAddressIndex(scriptID, ADDRESS_INDEX_SCRIPT, vAddressIndex));
+    BOOST_CHECK(vAddressIndex.empty());
+    vUnspent.clear();
+    BOOST_CHECK(GetAddressUnspent(scriptID, ADDRESS_INDEX_SCRIPT, vUnspent));
+    BOOST_CHECK(vUnspent.empty());
+
+    // Connected again, both blocks write their entries again
+    BOOST_CHECK(ReconsiderBlock(state, pindexPay));
+    BOOST_CHECK(ActivateBestChain(state));
+    BOOST_CHECK(chainActive.Tip() == pindexSpend);
+    vAddressIndex.clear();
+    BOOST_CHECK(GetAddressIndex(scriptID, ADDRESS_INDEX_SCRIPT, vAddressIndex));
+    BOOST_CHECK_EQUAL(vAddressIndex.size(), 2);
+    BOOST_CHECK(GetSpentIndex(CSpentIndexKey(hashPay, 0), spent));
+
+    mempool.clear();
+    InvalidateBlockTemplate();
+    fAddressIndex = false;
+    Checkpoints::fEnabled = true;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
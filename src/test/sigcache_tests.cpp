@@ -0,0 +1,78 @@
+// Copyright (c) 2019 The MktCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/sigcache.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+BOOST_AUTO_TEST_CASE(sigcache_hits)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CTransaction tx;
+
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+
+    uint64_t nHits0, nMisses0, nHits, nMisses;
+    GetSignatureCacheStats(nHits0, nMisses0);
+
+    // Not stored: both lookups miss
+    CachingTransactionSignatureChecker checkerNoStore(&tx, 0, false);
+    BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, pubkey, hash));
+    BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, pubkey, hash));
+    GetSignatureCacheStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits, nHits0);
+    BOOST_CHECK_EQUAL(nMisses, nMisses0 + 2);
+
+    // Stored on the first successful check, found on the second
+    CachingTransactionSignatureChecker checker(&tx, 0, true);
+    BOOST_CHECK(checker.VerifySignature(vchSig, pubkey, hash));
+    BOOST_CHECK(checker.VerifySignature(vchSig, pubkey, hash));
+    GetSignatureCacheStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits, nHits0 + 1);
+    BOOST_CHECK_EQUAL(nMisses, nMisses0 + 3);
+
+    // A different sighash, or the same bytes split differently, isn't a hit
+    uint256 hash2 = GetRandHash();
+    BOOST_CHECK(!checker.VerifySignature(vchSig, pubkey, hash2));
+    std::vector<unsigned char> vchShifted(pubkey.begin(), pubkey.end());
+    vchShifted.insert(vchShifted.end(), vchSig.begin(), vchSig.end());
+    BOOST_CHECK(!checker.VerifySignature(vchShifted, CPubKey(), hash));
+    GetSignatureCacheStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits, nHits0 + 1);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_messages)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CKey key2;
+    key2.MakeNewKey(true);
+
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.SignCompact(hash, vchSig));
+
+    BOOST_CHECK(!IsMessageSignatureCached(hash, vchSig, pubkey));
+    AddMessageSignatureToCache(hash, vchSig, pubkey);
+    BOOST_CHECK(IsMessageSignatureCached(hash, vchSig, pubkey));
+
+    // Only the exact (hash, signature, key) that was added is found
+    BOOST_CHECK(!IsMessageSignatureCached(GetRandHash(), vchSig, pubkey));
+    BOOST_CHECK(!IsMessageSignatureCached(hash, vchSig, key2.GetPubKey()));
+    std::vector<unsigned char> vchSig2(vchSig);
+    vchSig2[1] ^= 1;
+    BOOST_CHECK(!IsMessageSignatureCached(hash, vchSig2, pubkey));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -34,6 +34,7 @@ struct TestingSetup {
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
         SelectParams(CBaseChainParams::UNITTEST);
+        InitSignatureCache();
         noui_connect();
 #ifdef ENABLE_WALLET
         bitdb.MakeMock();
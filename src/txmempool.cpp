@@ -6,26 +6,30 @@
 #include "txmempool.h"
 
 #include "clientversion.h"
+#include "core_memusage.h"
 #include "main.h"
 #include "streams.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "version.h"
 
+#include <math.h>
+
 #include <boost/circular_buffer.hpp>
 
 using namespace std;
 
-CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nTime(0), dPriority(0.0)
+CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), inChainInputValue(0), nFeeDelta(0), dPriorityDelta(0.0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
 
-CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight, const CAmount& _inChainInputValue) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight), inChainInputValue(_inChainInputValue), nFeeDelta(0), dPriorityDelta(0.0)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
 
     nModSize = tx.CalculateModifiedSize(nTxSize);
+    nUsageSize = RecursiveDynamicUsage(tx);
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -36,8 +40,9 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
 double
 CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 {
-    CAmount nValueIn = tx.GetValueOut() + nFee;
-    double deltaPriority = ((double)(currentHeight - nHeight) * nValueIn) / nModSize;
+    // Only the inputs that were in the chain on entry age; signed, as the
+    // chain may have got shorter since
+    double deltaPriority = ((double)((int64_t)currentHeight - nHeight) * inChainInputValue) / nModSize;
     double dResult = dPriority + deltaPriority;
     return dResult;
 }
@@ -355,7 +360,15 @@ public:
 
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) : nTransactionsUpdated(0),
-                                                       minRelayFee(_minRelayFee)
+                                                       nTransactionsChanged(0),
+                                                       minRelayFee(_minRelayFee),
+                                                       totalTxSize(0),
+                                                       cachedInnerUsage(0),
+                                                       nMemPoolLinks(0),
+                                                       rollingMinimumFeeRate(0),
+                                                       lastRollingFeeUpdate(GetTime()),
+                                                       blockSinceLastRollingFeeBump(false),
+                                                       nPriorityHeight(0)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -400,6 +413,12 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
     nTransactionsUpdated += n;
 }
 
+unsigned int CTxMemPool::GetTransactionsChanged() const
+{
+    LOCK(cs);
+    return nTransactionsChanged;
+}
+
 
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
 {
@@ -408,16 +427,65 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
     // all the appropriate checks.
     LOCK(cs);
     {
-        mapTx[hash] = entry;
-        const CTransaction& tx = mapTx[hash].GetTx();
-        for (unsigned int i = 0; i < tx.vin.size(); i++)
+        CTxMemPoolEntry& newEntry = mapTx[hash] = entry;
+        newEntry.setMemPoolParents.clear();
+        newEntry.setMemPoolChildren.clear();
+        const CTransaction& tx = newEntry.GetTx();
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            const uint256& hashPrev = tx.vin[i].prevout.hash;
             mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
+            std::map<uint256, CTxMemPoolEntry>::iterator itParent = mapTx.find(hashPrev);
+            if (itParent != mapTx.end() && newEntry.setMemPoolParents.insert(hashPrev).second) {
+                itParent->second.setMemPoolChildren.insert(hash);
+                nMemPoolLinks++;
+            }
+        }
+        // Transactions put back after a reorg can already have children here
+        for (std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hash, 0));
+             it != mapNextTx.end() && it->first.hash == hash; ++it) {
+            const uint256 hashChild = it->second.ptx->GetHash();
+            if (newEntry.setMemPoolChildren.insert(hashChild).second) {
+                mapTx[hashChild].setMemPoolParents.insert(hash);
+                nMemPoolLinks++;
+            }
+        }
+        std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
+        newEntry.dPriorityDelta = pos == mapDeltas.end() ? 0.0 : pos->second.first;
+        newEntry.nFeeDelta = pos == mapDeltas.end() ? 0 : pos->second.second;
+        AddToIndexes(hash, newEntry);
         nTransactionsUpdated++;
         totalTxSize += entry.GetTxSize();
+        cachedInnerUsage += entry.DynamicMemoryUsage();
     }
     return true;
 }
 
+void CTxMemPool::AddToIndexes(const uint256& hash, const CTxMemPoolEntry& entry)
+{
+    indexByFeeRate.insert(std::make_pair(entry.GetModifiedFeeRate(), hash));
+    indexByPriority.insert(std::make_pair(entry.GetModifiedPriority(nPriorityHeight), hash));
+    indexByTime.insert(std::make_pair(entry.GetTime(), hash));
+}
+
+void CTxMemPool::RemoveFromIndexes(const uint256& hash, const CTxMemPoolEntry& entry)
+{
+    indexByFeeRate.erase(std::make_pair(entry.GetModifiedFeeRate(), hash));
+    indexByPriority.erase(std::make_pair(entry.GetModifiedPriority(nPriorityHeight), hash));
+    indexByTime.erase(std::make_pair(entry.GetTime(), hash));
+}
+
+const CTxMemPool::TxPriorityIndex& CTxMemPool::GetPriorityIndex(unsigned int nHeight)
+{
+    AssertLockHeld(cs);
+    if (nHeight != nPriorityHeight) {
+        nPriorityHeight = nHeight;
+        indexByPriority.clear();
+        for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++)
+            indexByPriority.insert(std::make_pair(it->second.GetModifiedPriority(nPriorityHeight), it->first));
+    }
+    return indexByPriority;
+}
+
 
 void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& removed, bool fRecursive)
 {
@@ -443,7 +511,8 @@ void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& rem
             txToRemove.pop_front();
             if (!mapTx.count(hash))
                 continue;
-            const CTransaction& tx = mapTx[hash].GetTx();
+            const CTxMemPoolEntry& entry = mapTx[hash];
+            const CTransaction& tx = entry.GetTx();
             if (fRecursive) {
                 for (unsigned int i = 0; i < tx.vout.size(); i++) {
                     std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
@@ -454,9 +523,16 @@ void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& rem
             }
             BOOST_FOREACH (const CTxIn& txin, tx.vin)
                 mapNextTx.erase(txin.prevout);
+            BOOST_FOREACH (const uint256& hashParent, entry.GetMemPoolParents())
+                mapTx[hashParent].setMemPoolChildren.erase(hash);
+            BOOST_FOREACH (const uint256& hashChild, entry.GetMemPoolChildren())
+                mapTx[hashChild].setMemPoolParents.erase(hash);
+            RemoveFromIndexes(hash, entry);
+            nMemPoolLinks -= entry.GetMemPoolParents().size() + entry.GetMemPoolChildren().size();
 
             removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
+            totalTxSize -= entry.GetTxSize();
+            cachedInnerUsage -= entry.DynamicMemoryUsage();
             mapTx.erase(hash);
             nTransactionsUpdated++;
         }
@@ -523,6 +599,8 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
         removeConflicts(tx, conflicts);
         ClearPrioritisation(tx.GetHash());
     }
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = true;
 }
 
 
@@ -531,8 +609,17 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    indexByFeeRate.clear();
+    indexByPriority.clear();
+    indexByTime.clear();
     totalTxSize = 0;
+    cachedInnerUsage = 0;
+    nMemPoolLinks = 0;
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = false;
+    rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
+    ++nTransactionsChanged;
 }
 
 void CTxMemPool::check(const CCoinsViewCache* pcoins) const
@@ -543,6 +630,8 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
     LogPrint("mempool", "Checking mempool with %u transactions and %u inputs\n", (unsigned int)mapTx.size(), (unsigned int)mapNextTx.size());
 
     uint64_t checkTotal = 0;
+    uint64_t innerUsage = 0;
+    uint64_t nLinks = 0;
 
     CCoinsViewCache mempoolDuplicate(const_cast<CCoinsViewCache*>(pcoins));
 
@@ -551,14 +640,19 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
     for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         unsigned int i = 0;
         checkTotal += it->second.GetTxSize();
+        innerUsage += it->second.DynamicMemoryUsage();
+        nLinks += it->second.GetMemPoolParents().size();
         const CTransaction& tx = it->second.GetTx();
         bool fDependsWait = false;
+        std::set<uint256> setParentsCheck;
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
             std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
             if (it2 != mapTx.end()) {
                 const CTransaction& tx2 = it2->second.GetTx();
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
+                assert(it2->second.GetMemPoolChildren().count(it->first));
+                setParentsCheck.insert(txin.prevout.hash);
                 fDependsWait = true;
             } else {
                 const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
@@ -571,6 +665,15 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
             assert(it3->second.n == i);
             i++;
         }
+        assert(setParentsCheck == it->second.GetMemPoolParents());
+        BOOST_FOREACH (const uint256& hashChild, it->second.GetMemPoolChildren()) {
+            std::map<uint256, CTxMemPoolEntry>::const_iterator itChild = mapTx.find(hashChild);
+            assert(itChild != mapTx.end());
+            assert(itChild->second.GetMemPoolParents().count(it->first));
+        }
+        assert(indexByFeeRate.count(std::make_pair(it->second.GetModifiedFeeRate(), it->first)));
+        assert(indexByPriority.count(std::make_pair(it->second.GetModifiedPriority(nPriorityHeight), it->first)));
+        assert(indexByTime.count(std::make_pair(it->second.GetTime(), it->first)));
         if (fDependsWait)
             waitingOnDependants.push_back(&it->second);
         else {
@@ -606,7 +709,12 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
         assert(it->first == it->second.ptx->vin[it->second.n].prevout);
     }
 
+    assert(indexByFeeRate.size() == mapTx.size());
+    assert(indexByPriority.size() == mapTx.size());
+    assert(indexByTime.size() == mapTx.size());
     assert(totalTxSize == checkTotal);
+    assert(cachedInnerUsage == innerUsage);
+    assert(nMemPoolLinks == nLinks);
 }
 
 void CTxMemPool::queryHashes(vector<uint256>& vtxid)
@@ -677,6 +785,14 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount>& deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+        if (it != mapTx.end()) {
+            RemoveFromIndexes(hash, it->second);
+            it->second.dPriorityDelta = deltas.first;
+            it->second.nFeeDelta = deltas.second;
+            AddToIndexes(hash, it->second);
+        }
+        nTransactionsChanged++;
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -696,6 +812,108 @@ void CTxMemPool::ClearPrioritisation(const uint256 hash)
 {
     LOCK(cs);
     mapDeltas.erase(hash);
+    std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+    if (it != mapTx.end()) {
+        RemoveFromIndexes(hash, it->second);
+        it->second.dPriorityDelta = 0.0;
+        it->second.nFeeDelta = 0;
+        AddToIndexes(hash, it->second);
+    }
+    nTransactionsChanged++;
+}
+
+size_t CTxMemPool::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    // Each parent-child link is kept in the sets of both entries
+    return memusage::DynamicUsage(mapTx) + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) +
+           memusage::DynamicUsage(indexByFeeRate) + memusage::DynamicUsage(indexByPriority) + memusage::DynamicUsage(indexByTime) +
+           nMemPoolLinks * 2 * memusage::MallocUsage(sizeof(memusage::stl_tree_node<uint256>)) + cachedInnerUsage;
+}
+
+int CTxMemPool::Expire(int64_t time)
+{
+    LOCK(cs);
+    std::vector<CTransaction> vExpired;
+    for (TxTimeIndex::const_iterator it = indexByTime.begin(); it != indexByTime.end() && it->first < time; it++)
+        vExpired.push_back(mapTx[it->second].GetTx());
+    int nRemoved = 0;
+    BOOST_FOREACH (const CTransaction& tx, vExpired) {
+        std::list<CTransaction> removed;
+        remove(tx, removed, true);
+        nRemoved += removed.size();
+    }
+    return nRemoved;
+}
+
+void CTxMemPool::trackPackageRemoved(const CFeeRate& rate)
+{
+    AssertLockHeld(cs);
+    if ((double)rate.GetFeePerK() > rollingMinimumFeeRate) {
+        rollingMinimumFeeRate = (double)rate.GetFeePerK();
+        blockSinceLastRollingFeeBump = false;
+    }
+}
+
+void CTxMemPool::TrimToSize(size_t sizelimit)
+{
+    LOCK(cs);
+    unsigned int nTxnRemoved = 0;
+    while (!indexByFeeRate.empty() && DynamicMemoryUsage() > sizelimit) {
+        // The transaction paying the least per byte goes, and what spends it
+        // with it; the fee rate of that package is what a transaction has to
+        // beat to take its place.
+        const uint256 hash = indexByFeeRate.rbegin()->second;
+        std::deque<uint256> queue(1, hash);
+        std::set<uint256> setPackage;
+        CAmount nPackageFees = 0;
+        size_t nPackageSize = 0;
+        while (!queue.empty()) {
+            const uint256 hashPackage = queue.front();
+            queue.pop_front();
+            if (!setPackage.insert(hashPackage).second)
+                continue;
+            const CTxMemPoolEntry& entry = mapTx[hashPackage];
+            nPackageFees += entry.GetModifiedFee();
+            nPackageSize += entry.GetTxSize();
+            queue.insert(queue.end(), entry.GetMemPoolChildren().begin(), entry.GetMemPoolChildren().end());
+        }
+        CFeeRate removedRate(nPackageFees, nPackageSize);
+        trackPackageRemoved(CFeeRate(removedRate.GetFeePerK() + minRelayFee.GetFeePerK()));
+
+        std::list<CTransaction> removed;
+        remove(mapTx[hash].GetTx(), removed, true);
+        nTxnRemoved += removed.size();
+    }
+    if (nTxnRemoved > 0)
+        LogPrint("mempool", "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, CFeeRate(llround(rollingMinimumFeeRate)).ToString());
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const
+{
+    LOCK(cs);
+    if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
+        return CFeeRate(llround(rollingMinimumFeeRate));
+
+    int64_t time = GetTime();
+    if (time > lastRollingFeeUpdate + 10) {
+        // Come down faster the emptier the pool is
+        double halflife = ROLLING_FEE_HALFLIFE;
+        size_t nUsage = DynamicMemoryUsage();
+        if (nUsage < sizelimit / 4)
+            halflife /= 4;
+        else if (nUsage < sizelimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (time - lastRollingFeeUpdate) / halflife);
+        lastRollingFeeUpdate = time;
+
+        if (rollingMinimumFeeRate < minRelayFee.GetFeePerK() / 2) {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return CFeeRate(llround(rollingMinimumFeeRate));
 }
 
 
@@ -7,6 +7,7 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
@@ -41,12 +42,20 @@ private:
     CAmount nFee;         //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize;       //! ... and avoid recomputing tx size
     size_t nModSize;      //! ... and modified size for priority
+    size_t nUsageSize;    //! ... and memory usage of the transaction
     int64_t nTime;        //! Local time when entering the mempool
     double dPriority;     //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    CAmount inChainInputValue; //! Value of the inputs in the chain, the part that ages
+
+    // Kept up to date by CTxMemPool while the entry is in it
+    CAmount nFeeDelta;                    //! Fee added by PrioritiseTransaction
+    double dPriorityDelta;                //! Priority added by PrioritiseTransaction
+    std::set<uint256> setMemPoolParents;  //! Mempool transactions this one spends
+    std::set<uint256> setMemPoolChildren; //! Mempool transactions spending this one
 
 public:
-    CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
+    CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight, const CAmount& _inChainInputValue);
     CTxMemPoolEntry();
     CTxMemPoolEntry(const CTxMemPoolEntry& other);
 
@@ -54,8 +63,33 @@ public:
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
     size_t GetTxSize() const { return nTxSize; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    CAmount GetInChainInputValue() const { return inChainInputValue; }
+
+    /** Fee and priority including the deltas from PrioritiseTransaction */
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+    CFeeRate GetModifiedFeeRate() const { return CFeeRate(GetModifiedFee(), nTxSize); }
+    double GetModifiedPriority(unsigned int currentHeight) const { return GetPriority(currentHeight) + dPriorityDelta; }
+
+    const std::set<uint256>& GetMemPoolParents() const { return setMemPoolParents; }
+    const std::set<uint256>& GetMemPoolChildren() const { return setMemPoolChildren; }
+
+    friend class CTxMemPool;
+};
+
+/** Orders (key, txid) pairs by key, highest first */
+template <typename Key>
+struct CompareMemPoolKeyDescending {
+    bool operator()(const std::pair<Key, uint256>& a, const std::pair<Key, uint256>& b) const
+    {
+        if (a.first > b.first)
+            return true;
+        if (b.first > a.first)
+            return false;
+        return a.second < b.second;
+    }
 };
 
 class CMinerPolicyEstimator;
@@ -96,12 +130,44 @@ class CTxMemPool
 private:
     bool fSanityCheck; //! Normally false, true if -checkmempool or -regtest
     unsigned int nTransactionsUpdated;
+    unsigned int nTransactionsChanged; //! Bumped when the deltas of a transaction change or the pool is cleared
     CMinerPolicyEstimator* minerPolicyEstimator;
 
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedInnerUsage; //! sum of the memory usage of all transactions
+    uint64_t nMemPoolLinks;    //! number of parent-child links between entries
+
+    //! Fee rate a transaction needs to get into the pool since it had to evict
+    //! some; decays once blocks come in
+    mutable double rollingMinimumFeeRate;
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+
+    void trackPackageRemoved(const CFeeRate& rate);
+
+public:
+    //! Transactions by modified fee rate, highest first
+    typedef std::set<std::pair<CFeeRate, uint256>, CompareMemPoolKeyDescending<CFeeRate> > TxFeeRateIndex;
+    //! Transactions by modified priority at nPriorityHeight, highest first
+    typedef std::set<std::pair<double, uint256>, CompareMemPoolKeyDescending<double> > TxPriorityIndex;
+    //! Transactions by the time they entered the pool, oldest first
+    typedef std::set<std::pair<int64_t, uint256> > TxTimeIndex;
+
+private:
+    TxFeeRateIndex indexByFeeRate;
+    TxPriorityIndex indexByPriority;
+    TxTimeIndex indexByTime;
+    //! Priorities grow with the height at different rates, so the priority
+    //! index is ordered for one height and reordered when asked for another
+    unsigned int nPriorityHeight;
+
+    void AddToIndexes(const uint256& hash, const CTxMemPoolEntry& entry);
+    void RemoveFromIndexes(const uint256& hash, const CTxMemPoolEntry& entry);
 
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
     mutable CCriticalSection cs;
     std::map<uint256, CTxMemPoolEntry> mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
@@ -129,12 +195,35 @@ public:
     void pruneSpent(const uint256& hash, CCoins& coins);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
+    /** Changes only on prioritisation and clear(), which the miner cannot apply to a template incrementally */
+    unsigned int GetTransactionsChanged() const;
 
     /** Affect CreateNewBlock prioritisation of transactions */
     void PrioritiseTransaction(const uint256 hash, const std::string strHash, double dPriorityDelta, const CAmount& nFeeDelta);
     void ApplyDeltas(const uint256 hash, double& dPriorityDelta, CAmount& nFeeDelta);
     void ClearPrioritisation(const uint256 hash);
 
+    /**
+     * Orderings of mapTx kept up to date as transactions come and go. The
+     * caller must hold cs for as long as it uses them.
+     */
+    const TxFeeRateIndex& GetFeeRateIndex() const { return indexByFeeRate; }
+    const TxPriorityIndex& GetPriorityIndex(unsigned int nHeight);
+    const TxTimeIndex& GetTimeIndex() const { return indexByTime; }
+
+    /** Remove the transactions that entered the pool before time, and those spending them. Returns the number removed. */
+    int Expire(int64_t time);
+    /**
+     * Evict the transactions with the lowest fee rate, together with those
+     * spending them, until the pool uses at most sizelimit bytes. The fee rate
+     * of what was evicted becomes the minimum to get back in.
+     */
+    void TrimToSize(size_t sizelimit);
+    /** The fee rate transactions need to get into a pool limited to sizelimit bytes, zero unless it is full */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+    /** Heap memory used by the pool */
+    size_t DynamicMemoryUsage() const;
+
     unsigned long size()
     {
         LOCK(cs);
@@ -754,12 +754,16 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     if (!AddToWalletIfInvolvingMe(tx, pblock, true))
         return; // Not one of ours
 
+    // The confirming block may have changed, drop any cached stake metadata
+    mapStakeCache.erase(tx.GetHash());
+
     // If a transaction changes 'conflicted' state, that changes the balance
     // available of the outputs it spends. So force those to be
     // recomputed, also:
     BOOST_FOREACH (const CTxIn& txin, tx.vin) {
         if (mapWallet.count(txin.prevout.hash))
             mapWallet[txin.prevout.hash].MarkDirty();
+        mapStakeCache.erase(txin.prevout.hash);
     }
 }
 
@@ -1563,9 +1567,51 @@ bool less_then_denom(const COutput& out1, const COutput& out2)
     return (!found1 && found2);
 }
 
+bool CWallet::GetStakeCacheEntry(const CWalletTx& wtx, CStakeCacheEntry& entry)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    const uint256 hashTx = wtx.GetHash();
+    std::map<uint256, CStakeCacheEntry>::iterator it = mapStakeCache.find(hashTx);
+    if (it != mapStakeCache.end()) {
+        // The modifier only depends on the blocks between pindexFrom and pindexModifier,
+        // so the entry stays valid for as long as both are part of the active chain
+        if (chainActive.Contains(it->second.pindexFrom) && chainActive.Contains(it->second.pindexModifier)) {
+            entry = it->second;
+            return true;
+        }
+        mapStakeCache.erase(it);
+    }
+
+    BlockMap::iterator mi = mapBlockIndex.find(wtx.hashBlock);
+    if (mi == mapBlockIndex.end() || !mi->second || !chainActive.Contains(mi->second))
+        return false;
+
+    CStakeCacheEntry entryNew;
+    entryNew.pindexFrom = mi->second;
+
+    // Coins past nStakeMinAge can still be younger than the modifier selection interval;
+    // GetKernelStakeModifier would sleep for them with cs_main and cs_wallet held
+    if (!HaveKernelStakeModifier(entryNew.pindexFrom))
+        return false;
+
+    int nStakeModifierHeight = 0;
+    int64_t nStakeModifierTime = 0;
+    if (!GetKernelStakeModifier(entryNew.pindexFrom->GetBlockHash(), entryNew.nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false))
+        return false;
+    entryNew.pindexModifier = chainActive[nStakeModifierHeight];
+    if (!entryNew.pindexModifier)
+        return false;
+
+    mapStakeCache[hashTx] = entryNew;
+    entry = entryNew;
+    return true;
+}
+
 bool CWallet::SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInputs, CAmount nTargetAmount)
 {
-    LOCK(cs_main);
+    LOCK2(cs_main, cs_wallet);
     //Add PIV
     vector<COutput> vCoins;
     AvailableCoins(vCoins, true);
@@ -1585,11 +1631,19 @@ bool CWallet::SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInp
         if (out.nDepth < (out.tx->IsCoinStake() ? Params().COINBASE_MATURITY() : 10))
             continue;
 
+        //resolve the confirming block and stake modifier
+        CStakeCacheEntry entry;
+        if (!GetStakeCacheEntry(*out.tx, entry)) {
+            LogPrint("staking", "%s : no stake metadata for %s\n", __func__, out.tx->GetHash().GetHex());
+            continue;
+        }
+
         //add to our stake set
         nAmountSelected += out.tx->vout[out.i].nValue;
 
         std::unique_ptr<CPivStake> input(new CPivStake());
         input->SetInput((CTransaction) *out.tx, out.i);
+        input->SetCachedMetadata(entry.pindexFrom, entry.nStakeModifier);
         listInputs.emplace_back(std::move(input));
     }
 
@@ -127,6 +127,20 @@ public:
     StringMap destdata;
 };
 
+/** Chain metadata of a confirmed wallet transaction, cached for the stake minter */
+struct CStakeCacheEntry {
+    CBlockIndex* pindexFrom;     //! block that confirmed the transaction
+    CBlockIndex* pindexModifier; //! block that generated the kernel stake modifier
+    uint64_t nStakeModifier;
+
+    CStakeCacheEntry()
+    {
+        pindexFrom = NULL;
+        pindexModifier = NULL;
+        nStakeModifier = 0;
+    }
+};
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -160,6 +174,14 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Confirming block and kernel stake modifier of wallet transactions, so that
+     * staking rounds do not hit the txindex for every candidate output.
+     * Entries are dropped in SyncTransaction and re-checked against chainActive on use.
+     */
+    std::map<uint256, CStakeCacheEntry> mapStakeCache;
+    bool GetStakeCacheEntry(const CWalletTx& wtx, CStakeCacheEntry& entry);
+
 public:
     bool MintableCoins();
     bool SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInputs, CAmount nTargetAmount);